@@ -0,0 +1,152 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <unordered_set>
+
+#include "accesstrace.h"
+#include "filestream.h"
+
+#define ACCESS_TRACE_MAGIC 0x54414355
+#define ACCESS_TRACE_VERSION 1
+
+namespace ucm {
+
+////////////////// AccessTrace //////////////////
+
+AccessTrace::~AccessTrace() {
+	this->close();
+}
+
+void AccessTrace::open(const string& path) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	
+	if (this->stream != NULL) {
+		this->stream->close();
+		delete this->stream;
+		this->stream = NULL;
+	}
+	
+	this->path = path;
+	FileStream* stream = new FileStream(this->path);
+	
+	try {
+		stream->openWrite();
+		
+		Header header = { };
+		header.magic = ACCESS_TRACE_MAGIC;
+		header.ver = ACCESS_TRACE_VERSION;
+		header.recordSize = sizeof(Record);
+		stream->write(&header, sizeof(header));
+	} catch (...) {
+		delete stream;
+		throw;
+	}
+	
+	this->stream = stream;
+	this->startTime = std::chrono::steady_clock::now();
+}
+
+void AccessTrace::close() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	
+	if (this->stream != NULL) {
+		this->stream->close();
+		delete this->stream;
+		this->stream = NULL;
+	}
+}
+
+uint64_t AccessTrace::getTime() const {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - this->startTime).count();
+}
+
+void AccessTrace::record(const uint uid, const uint format, const uint64_t bytes,
+												 const uint decompressTime, const uint flags) {
+	Record record = { };
+	record.uid = uid;
+	record.format = format;
+	record.bytes = bytes;
+	record.decompressTime = decompressTime;
+	record.flags = flags;
+	
+	std::lock_guard<std::mutex> guard(this->lock);
+	
+	if (this->stream == NULL) return;
+	
+	record.time = this->getTime();
+	this->stream->write(&record, sizeof(record));
+}
+
+////////////////// AccessTraceReader //////////////////
+
+void AccessTraceReader::load(const string& path) {
+	FileStream stream(path);
+	stream.openRead();
+	
+	AccessTrace::Header header = { };
+	if (stream.read(&header, sizeof(header)) < (int)sizeof(header)
+			|| header.magic != ACCESS_TRACE_MAGIC || header.ver != ACCESS_TRACE_VERSION
+			|| header.recordSize != sizeof(AccessTrace::Record)) {
+		throw AccessTraceFormatException();
+	}
+	
+	const size_t count = (stream.getLength() - sizeof(header)) / sizeof(AccessTrace::Record);
+	
+	this->records.resize(count);
+	
+	// FileStream reads at most an int worth of bytes per call
+	const size_t blockCount = 0x100000;
+	
+	for (size_t i = 0; i < count; i += blockCount) {
+		const size_t bytes = (count - i < blockCount ? count - i : blockCount) * sizeof(AccessTrace::Record);
+		if (stream.read(&this->records[i], (uint)bytes) < (int)bytes) {
+			throw AccessTraceFormatException();
+		}
+	}
+}
+
+std::vector<uint> AccessTraceReader::getRecommendedOrder() const {
+	std::vector<uint> order;
+	std::unordered_set<uint> seen;
+	
+	for (const AccessTrace::Record& record : this->records) {
+		if (seen.insert(record.uid).second) {
+			order.push_back(record.uid);
+		}
+	}
+	
+	return order;
+}
+
+std::vector<uint> AccessTraceReader::getPrefetchList(const uint64_t budget) const {
+	std::vector<uint> uids;
+	std::unordered_set<uint> seen;
+	uint64_t bytes = 0;
+	
+	for (const AccessTrace::Record& record : this->records) {
+		if (!seen.insert(record.uid).second) continue;
+		
+		// nothing to gain when the data was ready anyway
+		if ((record.flags & AccessTrace::ATF_Cached)
+				|| (!(record.flags & AccessTrace::ATF_Loaded) && record.decompressTime == 0)) {
+			continue;
+		}
+		
+		if (budget > 0 && bytes + record.bytes > budget) break;
+		
+		bytes += record.bytes;
+		uids.push_back(record.uid);
+	}
+	
+	return uids;
+}
+
+}
+
+#undef ACCESS_TRACE_MAGIC
+#undef ACCESS_TRACE_VERSION
@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef accesstrace_h
+#define accesstrace_h
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "types.h"
+#include "string.h"
+#include "exception.h"
+
+namespace ucm {
+
+class FileStream;
+
+// Log of trunk reads, written while an application runs and analyzed afterwards by
+// AccessTraceReader to store trunks in the order they are read. Records can be added
+// from many threads at once.
+class AccessTrace {
+public:
+	enum Flags {
+		ATF_None = 0,
+		// the decompressed data came from the cache
+		ATF_Cached = 0x1,
+		// the stored data was read from the archive file by this access
+		ATF_Loaded = 0x2,
+	};
+	
+	// times in microseconds, bytes of the data handed to the reader
+	struct Record {
+		uint uid;
+		uint format;
+		uint64_t time;
+		uint64_t bytes;
+		uint decompressTime;
+		uint flags;
+	};
+	
+private:
+	struct Header {
+		uint magic;
+		ushort ver;
+		ushort recordSize;
+	};
+	
+	string path;
+	FileStream* stream = NULL;
+	std::mutex lock;
+	std::chrono::steady_clock::time_point startTime;
+	
+	friend class AccessTraceReader;
+	
+public:
+	~AccessTrace();
+	
+	// create the trace file, record times start from here
+	void open(const string& path);
+	void close();
+	inline bool isOpened() const { return this->stream != NULL; }
+	
+	void record(const uint uid, const uint format, const uint64_t bytes,
+							const uint decompressTime, const uint flags);
+	
+	// microseconds since the trace was opened
+	uint64_t getTime() const;
+};
+
+class AccessTraceReader {
+private:
+	std::vector<AccessTrace::Record> records;
+	
+public:
+	// a record cut short by a crash of the traced program is ignored
+	void load(const string& path);
+	
+	inline const std::vector<AccessTrace::Record>& getRecords() const {
+		return this->records;
+	}
+	
+	// uids in the order of their first access, for Archive::compact
+	std::vector<uint> getRecommendedOrder() const;
+	
+	// uids whose first access read the file or decompressed data, in the order of that
+	// access, until their bytes reach budget; 0 means no limit
+	std::vector<uint> getPrefetchList(const uint64_t budget = 0) const;
+};
+
+class AccessTraceFormatException : public Exception {
+};
+
+}
+
+#endif /* accesstrace_h */
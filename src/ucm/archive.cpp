@@ -6,26 +6,82 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "archive.h"
+#include "file.h"
+#include "deflate.h"
+#include "checksum.h"
 #include <time.h>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #define FORMAT_TAG_SOBA 0x61626f73
 #define FORMAT_TAG_TOBA 0x61626f74
 
 namespace ucm {
 
-Archive::Archive() {
-	static bool randseeked = false;
-	if (!randseeked) {
-		srand((unsigned int)time(NULL));
-		randseeked = true;
+// counts and checksums the bytes on their way into the temporary file
+class ChunkWriter::SpillStream : public Stream {
+public:
+	FileStream& file;
+	uint64_t length = 0;
+	uint checksum = 0;
+	
+	SpillStream(FileStream& file) : file(file) { }
+	
+	int read(void*, const uint) { return 0; }
+	
+	size_t write(const void* buffer, const size_t length) {
+		this->file.write(buffer, length);
+		this->checksum = crc32c(buffer, length, this->checksum);
+		this->length += length;
+		return length;
 	}
+	
+	void flush() { this->file.flush(); }
+	
+	size_t getLength() const { return (size_t)this->length; }
+	size_t getPosition() const { return (size_t)this->length; }
+	// spilled data is only appended, seeking it is a bug of the caller
+	void setPosition(const size_t) { throw ArgumentOutOfRangeException(); }
+	bool isEnd() const { return true; }
+};
+
+Archive::Archive() {
 }
 
 Archive::~Archive() {
+	this->cancelPrefetch();
+	this->trunk.clear();
+	this->closeStream();
+}
+
+void Archive::openStream() {
+	FileStream* stream = new FileStream(this->path);
+	
+	try {
+		stream->openRead();
+	} catch (...) {
+		delete stream;
+		throw;
+	}
 	
+	this->trunk.attach(*stream);
+	this->closeStream();
+	this->stream = stream;
+}
+
+void Archive::closeStream() {
+	if (this->stream != NULL) {
+		delete this->stream;
+		this->stream = NULL;
+	}
 }
 
 ChunkEntry* Archive::newChunk(const uint format) {
+	WriteLockGuard guard(this->lock);
+	
 	ChunkEntry* entry = new ChunkEntry();
 	entry->uid = this->trunk.newTrunk(format);
 	entry->format = format;
@@ -34,16 +90,30 @@ ChunkEntry* Archive::newChunk(const uint format) {
 }
 
 ChunkEntry* Archive::openChunk(const uint uid, const uint format) {
+	ReadLockGuard guard(this->lock);
+	
+	// copied out under the read lock, other threads may drop the trunk data at any time
+	MemoryStream* stream = new MemoryStream();
+	
+	try {
+		this->trunk.readTrunkData(uid, format, *stream);
+	} catch (...) {
+		delete stream;
+		throw;
+	}
+	
+	stream->setPosition(0);
+	
 	ChunkEntry* entry = new ChunkEntry();
 	entry->uid = uid;
 	entry->format = format == 0 ? this->trunk.getTrunkFormat(uid) : format;
-	size_t dataLength;
-	const byte* buf = this->trunk.getTrunkData(uid, format, &dataLength);
-	entry->stream = new MemoryStream(buf, (uint)dataLength);
+	entry->stream = stream;
 	return entry;
 }
 
 uint Archive::touchChunk(const uint uid, const uint format) {
+	WriteLockGuard guard(this->lock);
+	
 	if (uid == 0) {
 		return this->trunk.newTrunk(format);
 	} else {
@@ -53,7 +123,9 @@ uint Archive::touchChunk(const uint uid, const uint format) {
 }
 
 void Archive::updateChunk(ChunkEntry* entry) {
-	const uint length = (uint)entry->stream->getLength();
+	WriteLockGuard guard(this->lock);
+
+	const size_t length = entry->stream->getLength();
 	
 #if defined(DEBUG)
 	if (length == 0) {
@@ -81,7 +153,121 @@ void Archive::updateAndCloseChunk(ChunkEntry *entry) {
 	this->closeChunk(entry);
 }
 
+// run task for indexes 0 to count - 1 on up to threadCount threads, the first exception
+// stops the remaining work and is thrown again
+template<typename T>
+static void parallelFor(const size_t count, const uint threadCount, T task) {
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errorLock;
+	
+	auto worker = [&]() {
+		try {
+			for (size_t i = next++; i < count; i = next++) {
+				task(i);
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> guard(errorLock);
+			if (!error) {
+				error = std::current_exception();
+			}
+			next = count;
+		}
+	};
+	
+	std::vector<std::thread> threads;
+	
+	for (uint i = 1; i < threadCount && i < count; i++) {
+		threads.push_back(std::thread(worker));
+	}
+	
+	worker();
+	
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+void Archive::commitChunks(std::vector<ChunkEntry*>& entries, uint threadCount) {
+	try {
+		this->insertChunks(entries, threadCount);
+	} catch (...) {
+		for (ChunkEntry* entry : entries) {
+			this->closeChunk(entry);
+		}
+		
+		entries.clear();
+		throw;
+	}
+	
+	for (ChunkEntry* entry : entries) {
+		this->closeChunk(entry);
+	}
+	
+	entries.clear();
+}
+
+void Archive::insertChunks(const std::vector<ChunkEntry*>& entries, uint threadCount) {
+	std::vector<FileTrunk::PreparedTrunkData> prepared(entries.size());
+	std::vector<bool> compress(entries.size(), true);
+	
+	for (size_t i = 0; i < entries.size(); i++) {
+		prepared[i].data = entries[i]->stream->getBuffer();
+		prepared[i].length = entries[i]->stream->getLength();
+		prepared[i].flags = entries[i]->isCompressed ? FileTrunk::FTF__Default : 0;
+	}
+	
+	if (threadCount == 0) {
+		threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0) threadCount = 1;
+	}
+	
+	bool deduplicate;
+	{
+		ReadLockGuard guard(this->lock);
+		deduplicate = this->trunk.getDeduplicate();
+	}
+	
+	// work without holding the lock, other threads may keep reading meanwhile
+	if (deduplicate) {
+		parallelFor(prepared.size(), threadCount, [&](const size_t i) {
+			FileTrunk::hashTrunkData(prepared[i]);
+		});
+		
+		// later copies in the batch share the data of the first one when inserted
+		std::unordered_map<uint64_t, size_t> firsts;
+		
+		for (size_t i = 0; i < prepared.size(); i++) {
+			auto first = firsts.insert(std::make_pair(prepared[i].hash, i));
+			if (!first.second && prepared[first.first->second].length == prepared[i].length
+					&& prepared[first.first->second].flags == prepared[i].flags) {
+				compress[i] = false;
+			}
+		}
+	}
+	
+	parallelFor(prepared.size(), threadCount, [&](const size_t i) {
+		if (compress[i]) {
+			FileTrunk::prepareTrunkData(prepared[i]);
+		}
+	});
+	
+	{
+		WriteLockGuard guard(this->lock);
+		
+		for (size_t i = 0; i < entries.size(); i++) {
+			this->trunk.setTrunkData(entries[i]->uid, entries[i]->format, prepared[i]);
+		}
+	}
+}
+
 void Archive::saveChunkData(const uint uid, const uint format, Stream& stream, bool isCompressed) {
+	WriteLockGuard guard(this->lock);
+	
 	auto chunk = this->openChunk(uid);
 	chunk->format = format;
 	chunk->isCompressed = isCompressed;
@@ -89,14 +275,50 @@ void Archive::saveChunkData(const uint uid, const uint format, Stream& stream, b
 	this->updateAndCloseChunk(chunk);
 }
 
+ChunkWriter* Archive::newChunkWriter(const uint format, const bool isCompressed) {
+	ChunkWriter* writer = new ChunkWriter(isCompressed);
+	writer->format = format;
+	
+	WriteLockGuard guard(this->lock);
+	
+	writer->uid = this->trunk.newTrunk(format);
+	return writer;
+}
+
+void Archive::closeChunk(ChunkWriter* writer) {
+	if (writer != NULL) {
+		delete writer;
+	}
+}
+
+void Archive::updateAndCloseChunk(ChunkWriter* writer) {
+	try {
+		writer->finish();
+	} catch (...) {
+		delete writer;
+		throw;
+	}
+	
+	{
+		WriteLockGuard guard(this->lock);
+		
+		this->trunk.setTrunkSource(writer->uid, writer->format, writer->spill, 0, writer->sink->length,
+															 writer->sink->checksum, writer->isCompressed ? FileTrunk::FTF_Compress : 0, writer->length);
+		writer->spill = NULL;
+	}
+	
+	delete writer;
+}
+
 void Archive::getTextChunkData(const uint uid, const uint format, string* str) {
 	if (str == NULL) return;
 	
-	size_t dataLength;
-	const byte* buf = this->trunk.getTrunkData(uid, format, &dataLength);
+	ReadLockGuard guard(this->lock);
+	
+	MemoryStream ms;
 	
-	if (buf != NULL && dataLength > 0) {
-		string::decode(buf, dataLength, str);
+	if (this->trunk.readTrunkData(uid, format, ms) && ms.getLength() > 0) {
+		string::decode(ms.getBuffer(), ms.getLength(), str);
 	}
 }
 
@@ -106,17 +328,47 @@ void Archive::setTextChunkData(const uint uid, const uint format, const string &
 	
 	string::encode(str, &buf, &dataLength);
 	
-	this->trunk.setTrunkData(uid, format, buf, (uint)dataLength);
+	WriteLockGuard guard(this->lock);
+	this->trunk.setTrunkData(uid, format, buf, dataLength);
 }
 
 bool Archive::deleteChunk(const uint uid, const uint format) {
+	WriteLockGuard guard(this->lock);
+
 	return this->trunk.deleteTrunk(uid, format);
 }
 
-void Archive::load(const string& path) {
-	FileStream stream(path);
-	stream.openRead();
+void Archive::load(const string& path, const bool lazy) {
+	// uids of the current archive mean nothing in the loaded one
+	this->cancelPrefetch();
+	
+	WriteLockGuard guard(this->lock);
+	
+	this->trunk.clear();
+	this->closeStream();
+	this->path = path;
+
+	this->recoverJournal(this->path);
+
+	if (!lazy) {
+		FileStream stream(this->path);
+		stream.openRead();
+		this->load(stream, FileTrunk::FTL_None);
+		return;
+	}
+
+	this->stream = new FileStream(this->path);
+
+	try {
+		this->stream->openRead();
+		this->load(*this->stream, FileTrunk::FTL_Lazy);
+	} catch (...) {
+		this->closeStream();
+		throw;
+	}
+}
 
+void Archive::load(FileStream& stream, const uint trunkLoadFlags) {
 	ArchiveFileHeader header;
 	int readBytes = stream.read(&header, sizeof(ArchiveFileHeader));
 	if ((size_t)readBytes < sizeof(ArchiveFileHeader)) {
@@ -131,16 +383,31 @@ void Archive::load(const string& path) {
 	this->fileInfo.format = header.format;
 	this->fileInfo.version = header.ver;
 
-	this->trunk.clear();
-	if (!this->trunk.load(stream)) {
+	if (!this->trunk.load(stream, trunkLoadFlags)) {
 		throw ArchiveFormatInvalidException();
 	}
 }
 
-void Archive::save(const string& path) {
-	FileStream stream(path);
-	stream.openWrite();
+void Archive::recoverJournal(const string& path) {
+	string journalPath(path);
+	journalPath.append(".journal");
+	
+	if (!File::exists(journalPath)) {
+		return;
+	}
 	
+	{
+		FileStream journal(journalPath);
+		journal.openRead();
+		FileStream target(path);
+		target.openUpdate();
+		FileTrunk::applyJournal(journal, target);
+	}
+	
+	File::remove(journalPath);
+}
+
+void Archive::save(FileStream& stream) {
 	ArchiveFileHeader header = { };
 	header.format = FORMAT_TAG_TOBA;
 	header.ver = 0x0100;
@@ -150,6 +417,309 @@ void Archive::save(const string& path) {
 	this->trunk.save(stream);
 }
 
+void Archive::save(const string& path) {
+	WriteLockGuard guard(this->lock);
+	
+	const bool lazy = this->stream != NULL;
+	
+	if (this->atomicSave) {
+		// chunks not loaded yet are still read from the current file while writing
+		string tempPath(path);
+		tempPath.append(".tmp");
+		
+		try {
+			FileStream stream(tempPath);
+			stream.openWrite();
+			this->save(stream);
+			stream.sync();
+		} catch (...) {
+			File::remove(tempPath);
+			throw;
+		}
+		
+		// an open file cannot be replaced on every platform
+		this->closeStream();
+		
+		if (!File::replace(tempPath, path)) {
+			// trunk offsets now describe the temporary file, keep using it
+			this->path = tempPath;
+			if (lazy) {
+				this->openStream();
+			}
+			throw FileException("cannot replace archive file");
+		}
+	} else {
+		// the file is about to be overwritten, bring lazily loaded chunks into memory first
+		if (lazy && this->path == path) {
+			this->trunk.detach();
+			this->closeStream();
+		}
+		
+		FileStream stream(path);
+		stream.openWrite();
+		this->save(stream);
+	}
+	
+	this->path = path;
+	
+	if (lazy) {
+		this->openStream();
+	}
+}
+
+void Archive::saveIncremental(const string& path) {
+	WriteLockGuard guard(this->lock);
+	
+	if (!this->trunk.isFileBound() || this->path != path) {
+		this->save(path);
+		return;
+	}
+	
+	bool saved;
+	
+	{
+		FileStream stream(this->path);
+		stream.openUpdate();
+		
+		if (this->journal) {
+			string journalPath(this->path);
+			journalPath.append(".journal");
+			
+			{
+				FileStream journal(journalPath);
+				journal.openWrite();
+				saved = this->trunk.saveIncremental(stream, &journal);
+			}
+			
+			File::remove(journalPath);
+		} else {
+			saved = this->trunk.saveIncremental(stream);
+		}
+	}
+	
+	if (!saved
+			|| (this->compactThreshold > 0
+					&& this->trunk.getDeadBytes() > this->trunk.getFileLength() * this->compactThreshold)) {
+		this->compact();
+	}
+}
+
+void Archive::compact() {
+	WriteLockGuard guard(this->lock);
+
+	this->save(this->path);
+}
+
+void Archive::compact(const std::vector<uint>& accessOrder) {
+	WriteLockGuard guard(this->lock);
+
+	this->trunk.sortTrunks(accessOrder);
+	this->save(this->path);
+}
+
+void Archive::compactByFormat() {
+	WriteLockGuard guard(this->lock);
+
+	this->trunk.sortTrunksByFormat();
+	this->save(this->path);
+}
+
+void Archive::sortChunks(const std::vector<uint>& accessOrder) {
+	WriteLockGuard guard(this->lock);
+
+	this->trunk.sortTrunks(accessOrder);
+}
+
+void Archive::sortChunksByFormat() {
+	WriteLockGuard guard(this->lock);
+
+	this->trunk.sortTrunksByFormat();
+}
+
+void Archive::createDelta(const string& basePath, const string& targetPath, const string& deltaPath) {
+	Archive base, target;
+	base.load(basePath, true);
+	target.load(targetPath, true);
+	
+	FileStream stream(deltaPath);
+	stream.openWrite();
+	FileTrunk::createDelta(base.trunk, target.trunk, stream);
+	stream.sync();
+}
+
+void Archive::applyDelta(const string& deltaPath) {
+	WriteLockGuard guard(this->lock);
+	
+	if (!this->trunk.isFileBound()) {
+		throw ArchiveDeltaException();
+	}
+	
+	FileStream* delta = new FileStream(deltaPath);
+	
+	try {
+		delta->openRead();
+		
+		if (!this->trunk.applyDelta(delta)) {
+			throw ArchiveDeltaException();
+		}
+	} catch (...) {
+		delete delta;
+		throw;
+	}
+	
+	this->saveIncremental(this->path);
+	
+	if (this->stream == NULL) {
+		// bring the applied chunks into memory like the rest, releasing the delta file
+		FileStream stream(this->path);
+		stream.openRead();
+		this->trunk.attach(stream);
+		this->trunk.detach();
+	}
+}
+
+void Archive::prefetch(const std::vector<uint>& uids, const size_t budget) {
+	std::lock_guard<std::mutex> guard(this->prefetchLock);
+	
+	this->prefetchCancelled = true;
+	if (this->prefetchThread.joinable()) {
+		this->prefetchThread.join();
+	}
+	
+	this->prefetchCancelled = false;
+	this->prefetching = true;
+	this->prefetchThread = std::thread(&Archive::runPrefetch, this, uids, budget);
+}
+
+void Archive::cancelPrefetch() {
+	std::lock_guard<std::mutex> guard(this->prefetchLock);
+	
+	this->prefetchCancelled = true;
+	if (this->prefetchThread.joinable()) {
+		this->prefetchThread.join();
+	}
+}
+
+void Archive::runPrefetch(const std::vector<uint> uids, const size_t budget) {
+	size_t prefetchedBytes = 0;
+	
+	for (const uint uid : uids) {
+		if (this->prefetchCancelled) break;
+		
+		// taken for each chunk so that writers are not held up by the whole list
+		ReadLockGuard guard(this->lock);
+		
+		const size_t capacity = this->trunk.getCache().getCapacity();
+		if (prefetchedBytes >= (budget > 0 && budget < capacity ? budget : capacity)) break;
+		
+		size_t length = 0;
+		
+		try {
+			if (!this->trunk.prefetchTrunk(uid, 0, &length)) continue;
+		} catch (...) {
+			continue;
+		}
+		
+		prefetchedBytes += length;
+	}
+	
+	this->prefetching = false;
+}
+
+bool Archive::verify(uint threadCount, std::vector<uint>* corruptedUids) {
+	ReadLockGuard guard(this->lock);
+	
+	if (!this->trunk.isFileBound()) {
+		return true;
+	}
+	
+	if (threadCount == 0) {
+		threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0) threadCount = 1;
+	}
+	
+	std::vector<FileStream*> streams;
+	bool valid;
+	
+	try {
+		for (uint i = 0; i < threadCount; i++) {
+			streams.push_back(new FileStream(this->path));
+			streams.back()->openRead();
+		}
+		
+		valid = this->trunk.verify(streams, corruptedUids);
+	} catch (...) {
+		for (FileStream* stream : streams) delete stream;
+		throw;
+	}
+	
+	for (FileStream* stream : streams) delete stream;
+	
+	return valid;
+}
+
+////////////////// ChunkWriter //////////////////
+
+ChunkWriter::ChunkWriter(const bool isCompressed) : isCompressed(isCompressed) {
+	this->spill = new FileStream();
+	
+	try {
+		this->spill->openTemporary();
+	} catch (...) {
+		delete this->spill;
+		throw;
+	}
+	
+	this->sink = new SpillStream(*this->spill);
+	
+	if (isCompressed) {
+		this->compressor.reset(new CompressStream(*this->sink));
+	}
+}
+
+ChunkWriter::~ChunkWriter() {
+	this->compressor.reset();
+	
+	if (this->sink != NULL) {
+		delete this->sink;
+		this->sink = NULL;
+	}
+	
+	if (this->spill != NULL) {
+		delete this->spill;
+		this->spill = NULL;
+	}
+}
+
+size_t ChunkWriter::write(const void* buffer, const size_t length) {
+	if (this->compressor == NULL) {
+		this->sink->write(buffer, length);
+	} else {
+		// zlib takes at most an uint worth of bytes per call
+		const size_t blockSize = 0x40000000;
+		
+		for (size_t offset = 0; offset < length; offset += blockSize) {
+			const size_t remaining = length - offset;
+			this->compressor->write((const byte*)buffer + offset, (uint)(remaining < blockSize ? remaining : blockSize));
+		}
+	}
+	
+	this->length += length;
+	return length;
+}
+
+void ChunkWriter::setPosition(const size_t pos) {
+	if (pos != this->length) {
+		throw ArgumentOutOfRangeException();
+	}
+}
+
+void ChunkWriter::finish() {
+	if (this->compressor != NULL) {
+		this->compressor->flush();
+	}
+}
+
 ////////////////// ChunkEntry //////////////////
 
 ChunkEntry::ChunkEntry() {
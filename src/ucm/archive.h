@@ -8,19 +8,35 @@
 #ifndef archive_h
 #define archive_h
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "stream.h"
 #include "trunk.h"
+#include "rwlock.h"
 
 namespace ucm {
 
 class ChunkEntry;
+class ChunkWriter;
 class ArchiveInfo;
+class CompressStream;
 
+// Chunks can be opened and read from many threads at once, other operations wait
+// until they finish and run alone.
 class Archive {
 	friend ArchiveInfo;
 	
 private:
 	FileTrunk trunk;
+	mutable ReadWriteLock lock;
+	
+	// path and stream of the archive file, the stream is kept open in lazy load mode
+	string path;
+	FileStream* stream = NULL;
 	
 	struct ArchiveFileHeader {
 		uint format;
@@ -29,6 +45,24 @@ private:
 		uint headerSize;
 		uint reserved;
 	};
+	
+	double compactThreshold = 0.5;
+	bool atomicSave = true;
+	bool journal = false;
+	
+	// background reads scheduled by prefetch, prefetchLock guards the thread object
+	std::thread prefetchThread;
+	std::mutex prefetchLock;
+	std::atomic<bool> prefetchCancelled { false };
+	std::atomic<bool> prefetching { false };
+	
+	void runPrefetch(const std::vector<uint> uids, const size_t budget);
+	void insertChunks(const std::vector<ChunkEntry*>& entries, uint threadCount);
+	void load(FileStream& stream, const uint trunkLoadFlags);
+	void save(FileStream& stream);
+	void recoverJournal(const string& path);
+	void openStream();
+	void closeStream();
 
 public:
 	Archive();
@@ -45,15 +79,129 @@ public:
 	void updateChunk(ChunkEntry* entry);
 	void closeChunk(ChunkEntry* entry);
 	void updateAndCloseChunk(ChunkEntry* entry);
+	
+	// update and close all entries, compressing them in parallel with threadCount threads
+	// (0 uses one per hardware thread); trunks are inserted in entry order, so the archive
+	// is the same as after calling updateAndCloseChunk for each entry. The entries are
+	// closed and the list cleared also when an exception is thrown; a failure while
+	// compressing leaves the archive unchanged, one while inserting keeps the trunks of
+	// the entries before the failing one
+	void commitChunks(std::vector<ChunkEntry*>& entries, uint threadCount = 0);
 	void saveChunkData(const uint uid, const uint format, Stream& stream, bool isCompressed = true);
 	
+	// stream a new chunk into the archive without holding it in memory, the data is
+	// compressed while written and kept in a temporary file until the archive is saved;
+	// updateAndCloseChunk adds the chunk, closeChunk discards the written data
+	ChunkWriter* newChunkWriter(const uint format = 0, const bool isCompressed = true);
+	void closeChunk(ChunkWriter* writer);
+	void updateAndCloseChunk(ChunkWriter* writer);
+	
 	void getTextChunkData(const uint uid, const uint format, string* str);
 	void setTextChunkData(const uint uid, const uint format, const string& str);
 	
 	bool deleteChunk(const uint uid, const uint format = 0);
 
-	void load(const string& path);
+	// lazy load reads only the trunk index, chunk data is read from the file when opened
+	void load(const string& path, const bool lazy = false);
 	void save(const string& path);
+	
+	// append only the changed chunks to the file last loaded from or saved to, other
+	// paths are saved in full; the file is rewritten once its dead space exceeds the
+	// compact threshold
+	void saveIncremental(const string& path);
+	void compact();
+	
+	// rewrite the archive file without dead space, storing chunks in the order they are
+	// listed in accessOrder followed by the others, so loading them in that order reads
+	// the file sequentially
+	void compact(const std::vector<uint>& accessOrder);
+	
+	// rewrite the archive file without dead space, storing chunks grouped by format
+	void compactByFormat();
+	
+	// order chunks for the next full save like compact does, to write them to another file
+	void sortChunks(const std::vector<uint>& accessOrder);
+	void sortChunksByFormat();
+	
+	// write the chunks added, removed and changed from the archive at basePath to the one
+	// at targetPath into a delta file
+	static void createDelta(const string& basePath, const string& targetPath, const string& deltaPath);
+	
+	// apply a delta to the archive loaded from its file and save it incrementally, so only
+	// changed chunks and the index are written; throws ArchiveDeltaException and leaves
+	// the archive unchanged when the delta is damaged or was created from another base
+	void applyDelta(const string& deltaPath);
+	
+	// read and decompress the chunks on a background thread in the listed order, so that
+	// openChunk finds them in the cache; chunks still pending from an earlier call are
+	// dropped. Stops once budget bytes of chunk data were prefetched, 0 and larger values
+	// mean the cache capacity. Chunks that fail to read are skipped and fail in openChunk.
+	void prefetch(const std::vector<uint>& uids, const size_t budget = 0);
+	
+	// stop prefetching, waits for the chunk being read to finish
+	void cancelPrefetch();
+	inline bool isPrefetching() const { return this->prefetching; }
+	
+	// check every chunk stored in the archive file against its checksum, reading the
+	// file with threadCount streams in parallel, 0 uses one per hardware thread
+	bool verify(uint threadCount = 0, std::vector<uint>* corruptedUids = NULL);
+	
+	// write full saves into a temporary file and replace the target file only once the
+	// temporary file is durable, so a failed save never destroys the existing archive
+	inline void setAtomicSave(const bool enabled) {
+		this->atomicSave = enabled;
+	}
+	
+	// sync incremental saves through a write-ahead journal file, an interrupted save
+	// is recovered the next time the archive is loaded
+	inline void setJournal(const bool enabled) {
+		this->journal = enabled;
+	}
+	
+	// ratio of dead space to file size that triggers compact on incremental save, 0 disables
+	inline void setCompactThreshold(const double ratio) {
+		this->compactThreshold = ratio;
+	}
+	
+	// chunks with identical content share one data block in memory and in the file
+	inline void setDeduplicate(const bool enabled) {
+		WriteLockGuard guard(this->lock);
+		this->trunk.setDeduplicate(enabled);
+	}
+	
+	// chooses uids of new chunks, see FileTrunk::setUidAllocator; the sequential
+	// allocators give the same uids on every run for the same sequence of changes
+	inline void setUidAllocator(UidAllocator* allocator) {
+		WriteLockGuard guard(this->lock);
+		this->trunk.setUidAllocator(allocator);
+	}
+	
+	// record chunk reads into trace for AccessTraceReader, NULL stops recording
+	inline void setAccessTrace(AccessTrace* trace) {
+		WriteLockGuard guard(this->lock);
+		this->trunk.setAccessTrace(trace);
+	}
+	
+	inline size_t getDeadBytes() const {
+		ReadLockGuard guard(this->lock);
+		return this->trunk.getDeadBytes();
+	}
+	
+	// limit memory used by chunk data of a lazily loaded archive, 0 means unlimited
+	inline void setResidentLimit(const size_t bytes) {
+		WriteLockGuard guard(this->lock);
+		this->trunk.setResidentLimit(bytes);
+	}
+	
+	// limit memory used by decompressed chunk data, the latest opened chunk is always kept
+	inline void setCacheCapacity(const size_t bytes) {
+		WriteLockGuard guard(this->lock);
+		this->trunk.getCache().setCapacity(bytes);
+	}
+	
+	inline const TrunkDataCache& getCache() const {
+		return this->trunk.getCache();
+	}
 };
 
 class ChunkEntry {
@@ -70,6 +218,39 @@ public:
 	bool isCompressed = true;
 };
 
+// Write-only stream of a new chunk, memory use is bounded by the compression buffers
+// whatever the chunk size.
+class ChunkWriter : public Stream {
+	friend Archive;
+	
+private:
+	class SpillStream;
+	
+	FileStream* spill = NULL;
+	SpillStream* sink = NULL;
+	std::unique_ptr<CompressStream> compressor;
+	size_t length = 0;
+	
+	ChunkWriter(const bool isCompressed);
+	~ChunkWriter();
+	
+	void finish();
+	
+public:
+	uint uid = 0;
+	uint format = 0;
+	const bool isCompressed;
+	
+	int read(void*, const uint) { return 0; }
+	size_t write(const void* buffer, const size_t length);
+	void flush() { }
+	
+	size_t getLength() const { return this->length; }
+	size_t getPosition() const { return this->length; }
+	void setPosition(const size_t pos);
+	bool isEnd() const { return true; }
+};
+
 class ArchiveInfo {
 private:
 	const Archive& archive;
@@ -82,13 +263,20 @@ public:
 		}
 		
 		logicalArchiveSize = sizeof(Archive::ArchiveFileHeader)
-			+ this->totalDataBytes
-			+ this->archive.trunk.getCount() * sizeof(uint) * 6 // trunk index
-			+ sizeof(uint) * 4; // trunk header
+			+ this->archive.trunk.getSaveLength();
+		
+		if (this->archive.trunk.isFileBound()) {
+			fileSize = sizeof(Archive::ArchiveFileHeader) + this->archive.trunk.getFileLength();
+			deadBytes = this->archive.trunk.getDeadBytes();
+		}
 	}
 	
-	uint totalDataBytes = 0;
-	uint logicalArchiveSize = 0;
+	uint64_t totalDataBytes = 0;
+	uint64_t logicalArchiveSize = 0;
+	
+	// size of the file last loaded or saved and the bytes in it no chunk refers to
+	uint64_t fileSize = 0;
+	uint64_t deadBytes = 0;
 	
 	inline const FileTrunk& getTrunks() const {
 		return this->archive.trunk;
@@ -99,6 +287,9 @@ class ArchiveFormatInvalidException : public Exception {
 	
 };
 
+class ArchiveDeltaException : public Exception {
+};
+
 }
 
 #endif /* archive_h */
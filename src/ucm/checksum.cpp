@@ -0,0 +1,253 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <stdint.h>
+
+#include "checksum.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_X86
+#define CRC32C_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_X86
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+// reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82f63b78
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+namespace ucm {
+
+// slicing-by-8 tables for CPUs without CRC instructions
+struct Crc32cTable {
+	uint table[8][256];
+
+	Crc32cTable() {
+		for (uint i = 0; i < 256; i++) {
+			uint crc = i;
+			for (int k = 0; k < 8; k++) {
+				crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+			}
+			this->table[0][i] = crc;
+		}
+
+		for (uint i = 0; i < 256; i++) {
+			for (int t = 1; t < 8; t++) {
+				const uint prev = this->table[t - 1][i];
+				this->table[t][i] = (prev >> 8) ^ this->table[0][prev & 0xff];
+			}
+		}
+	}
+};
+
+static uint crc32cSoftware(uint crc, const byte* p, size_t length) {
+	static const Crc32cTable tables;
+	const uint (*t)[256] = tables.table;
+
+	while (length >= 8) {
+		uint lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+			^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+
+		p += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	}
+
+	return crc;
+}
+
+#if defined(CRC32C_X86)
+
+static bool hasCrc32cInstruction() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+#else
+	return __builtin_cpu_supports("sse4.2");
+#endif /* _MSC_VER */
+}
+
+CRC32C_TARGET static uint crc32cHardware(uint crc, const byte* p, size_t length) {
+	while (length > 0 && ((size_t)p & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		length--;
+	}
+
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc;
+	while (length >= 8) {
+		crc64 = _mm_crc32_u64(crc64, *(const uint64_t*)p);
+		p += 8;
+		length -= 8;
+	}
+	crc = (uint)crc64;
+#endif /* x64 */
+
+	while (length >= 4) {
+		crc = _mm_crc32_u32(crc, *(const uint*)p);
+		p += 4;
+		length -= 4;
+	}
+
+	while (length-- > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+
+	return crc;
+}
+
+#elif defined(CRC32C_ARM)
+
+static bool hasCrc32cInstruction() {
+	return true;
+}
+
+static uint crc32cHardware(uint crc, const byte* p, size_t length) {
+	while (length > 0 && ((size_t)p & 7) != 0) {
+		crc = __crc32cb(crc, *p++);
+		length--;
+	}
+
+	while (length >= 8) {
+		crc = __crc32cd(crc, *(const uint64_t*)p);
+		p += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0) {
+		crc = __crc32cb(crc, *p++);
+	}
+
+	return crc;
+}
+
+#endif /* CRC32C_X86 */
+
+uint crc32c(const void* data, const size_t length, const uint crc) {
+	const byte* p = (const byte*)data;
+
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+	static const bool hardware = hasCrc32cInstruction();
+
+	if (hardware) {
+		return ~crc32cHardware(~crc, p, length);
+	}
+#endif /* CRC32C_X86 || CRC32C_ARM */
+
+	return ~crc32cSoftware(~crc, p, length);
+}
+
+
+static inline uint64_t rotl64(const uint64_t x, const int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const byte* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxhRound(uint64_t acc, const uint64_t input) {
+	acc += input * XXH_PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxhMergeRound(uint64_t acc, const uint64_t val) {
+	acc ^= xxhRound(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t xxhash64(const void* data, const size_t length, const uint64_t seed) {
+	const byte* p = (const byte*)data;
+	const byte* end = p + length;
+	uint64_t h;
+
+	if (length >= 32) {
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+
+		do {
+			v1 = xxhRound(v1, read64(p));
+			v2 = xxhRound(v2, read64(p + 8));
+			v3 = xxhRound(v3, read64(p + 16));
+			v4 = xxhRound(v4, read64(p + 24));
+			p += 32;
+		} while (end - p >= 32);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxhMergeRound(h, v1);
+		h = xxhMergeRound(h, v2);
+		h = xxhMergeRound(h, v3);
+		h = xxhMergeRound(h, v4);
+	} else {
+		h = seed + XXH_PRIME64_5;
+	}
+
+	h += (uint64_t)length;
+
+	while (end - p >= 8) {
+		h ^= xxhRound(0, read64(p));
+		h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+		p += 8;
+	}
+
+	if (end - p >= 4) {
+		uint v;
+		memcpy(&v, p, sizeof(v));
+		h ^= (uint64_t)v * XXH_PRIME64_1;
+		h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		h ^= (uint64_t)*p++ * XXH_PRIME64_5;
+		h = rotl64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+}
+
+#undef CRC32C_POLY
+#undef XXH_PRIME64_1
+#undef XXH_PRIME64_2
+#undef XXH_PRIME64_3
+#undef XXH_PRIME64_4
+#undef XXH_PRIME64_5
@@ -0,0 +1,27 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef checksum_h
+#define checksum_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "types.h"
+
+namespace ucm {
+
+// CRC-32C (Castagnoli) of data, pass the previous result as crc to continue a checksum
+// over several blocks. Uses the SSE 4.2 or ARMv8 CRC instructions when available.
+uint crc32c(const void* data, const size_t length, const uint crc = 0);
+
+// 64-bit xxHash of data, a fast non-cryptographic hash for identifying content
+uint64_t xxhash64(const void* data, const size_t length, const uint64_t seed = 0);
+
+}
+
+#endif /* checksum_h */
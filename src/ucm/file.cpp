@@ -11,12 +11,15 @@
 #include <memory>
 
 #if _WIN32
+#include <Windows.h>
 #include <Shlwapi.h>
 #pragma comment(lib, "Shlwapi.lib")
 #define _fopen(filename, access, FILE)    fopen_s(&FILE, filename, access)
 #else
 #define _fopen(filename, access, FILE)    FILE = fopen(filename, access)
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #endif
 
@@ -129,6 +132,42 @@ void File::writeBinaryFile(const char* filename, void* buffer, const int len) {
 	file.close();
 }
 
+bool File::exists(const char* filename) {
+#if _WIN32
+	return PathFileExistsA(filename) == 1;
+#else
+	struct stat st;
+	return stat(filename, &st) == 0;
+#endif
+}
+
+bool File::remove(const char* filename) {
+	return ::remove(filename) == 0;
+}
+
+bool File::replace(const char* source, const char* target) {
+#if _WIN32
+	return MoveFileExA(source, target, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (::rename(source, target) != 0) {
+		return false;
+	}
+	
+	// sync the directory entry as well
+	File file(target);
+	const char* dir = !file.getPath().isEmpty() ? file.getPath().getBuffer()
+		: (target[0] == PATH_SPLITTER ? PATH_SPLITTER_STR : ".");
+	
+	int fd = ::open(dir, O_RDONLY);
+	if (fd >= 0) {
+		::fsync(fd);
+		::close(fd);
+	}
+	
+	return true;
+#endif
+}
+
 bool File::isExist() const {
 #if _WIN32
 	return PathFileExistsA(this->fullPathName) == 1;
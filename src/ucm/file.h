@@ -75,6 +75,12 @@ public:
   static void writeTextFile(const char* filename, const char* str);
 	
 	static void writeBinaryFile(const char* filename, void* buffer, const int len);
+	
+	static bool exists(const char* filename);
+	static bool remove(const char* filename);
+	
+	// replace target with source in one step, the rename is durable once this returns
+	static bool replace(const char* source, const char* target);
 };
 
 }
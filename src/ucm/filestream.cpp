@@ -13,11 +13,21 @@
 
 #if _WIN32
 #include <Shlwapi.h>
+#include <io.h>
 #pragma comment(lib, "Shlwapi.lib")
 #define _fopen(filename, access, FILE)    fopen_s(&FILE, filename, access)
+#define _tmpfile(FILE)                    tmpfile_s(&FILE)
+#define _fsync(FILE)                      _commit(_fileno(FILE))
+#define _fseek64(FILE, offset, origin)    _fseeki64(FILE, offset, origin)
+#define _ftell64(FILE)                    _ftelli64(FILE)
 #else
 #define _fopen(filename, access, FILE)    FILE = fopen(filename, access)
+#define _tmpfile(FILE)                    FILE = tmpfile()
+#define _fsync(FILE)                      fsync(fileno(FILE))
+#define _fseek64(FILE, offset, origin)    fseeko(FILE, (off_t)(offset), origin)
+#define _ftell64(FILE)                    ftello(FILE)
 #include <dirent.h>
+#include <unistd.h>
 #endif
 
 namespace ucm {
@@ -40,10 +50,22 @@ void FileStream::open(const FileStreamBehavior behavior, const FileStreamType st
     throw FileException("file in use");
   }
   
-  _fopen(this->filename,
-         streamType == FileStreamType::Binary ?
-         (behavior == FileStreamBehavior::Read ? "rb" : "wb") :
-         (behavior == FileStreamBehavior::Read ? "r" : "w"), this->fileHandler);
+  const char* mode;
+  
+  switch (behavior) {
+    default:
+    case FileStreamBehavior::Read:
+      mode = streamType == FileStreamType::Binary ? "rb" : "r";
+      break;
+    case FileStreamBehavior::Write:
+      mode = streamType == FileStreamType::Binary ? "wb" : "w";
+      break;
+    case FileStreamBehavior::Update:
+      mode = streamType == FileStreamType::Binary ? "r+b" : "r+";
+      break;
+  }
+  
+  _fopen(this->filename, mode, this->fileHandler);
 
 	if (this->fileHandler == NULL) {
 		fprintf(stderr, "open file error: %s\n", this->filename);
@@ -51,6 +73,19 @@ void FileStream::open(const FileStreamBehavior behavior, const FileStreamType st
 	}
 }
 
+void FileStream::openTemporary() {
+  if (this->fileHandler != NULL) {
+    throw FileException("file in use");
+  }
+  
+  this->filename = "";
+  _tmpfile(this->fileHandler);
+  
+  if (this->fileHandler == NULL) {
+    throw FileException("cannot create temporary file");
+  }
+}
+
 int FileStream::read(void* buffer, const uint length) {
 	return (int)fread(buffer, 1, length, this->fileHandler);
 }
@@ -87,8 +122,22 @@ void FileStream::writeText(const char* str) const {
   fputs(str, this->fileHandler);
 }
 
+void FileStream::flush() {
+	if (this->fileHandler != NULL && fflush(this->fileHandler) != 0) {
+		throw FileException("file flush failed");
+	}
+}
+
+void FileStream::sync() {
+	this->flush();
+	
+	if (this->fileHandler != NULL && _fsync(this->fileHandler) != 0) {
+		throw FileException("file sync failed");
+	}
+}
+
 size_t FileStream::getPosition() const {
-	long pos = ftell(this->fileHandler);
+	const long long pos = _ftell64(this->fileHandler);
 	if (pos < 0) {
 		throw FileException("ftell failed");
 	}
@@ -96,22 +145,22 @@ size_t FileStream::getPosition() const {
 }
 
 size_t FileStream::getLength() const {
-	long cur = ftell(this->fileHandler);
-	if (cur < 0 || fseek(this->fileHandler, 0, SEEK_END) != 0) {
+	const long long cur = _ftell64(this->fileHandler);
+	if (cur < 0 || _fseek64(this->fileHandler, 0, SEEK_END) != 0) {
 		throw FileException("seek to end failed");
 	}
-	long len = ftell(this->fileHandler);
+	const long long len = _ftell64(this->fileHandler);
 	if (len < 0) {
 		throw FileException("ftell at end failed");
 	}
-	if (fseek(this->fileHandler, cur, SEEK_SET) != 0) {
+	if (_fseek64(this->fileHandler, cur, SEEK_SET) != 0) {
 		throw FileException("restore seek position failed");
 	}
 	return (size_t)len;
 }
 
 void FileStream::setPosition(const size_t pos) {
-	fseek(this->fileHandler, (long)pos, SEEK_SET);
+	_fseek64(this->fileHandler, pos, SEEK_SET);
 }
 
 bool FileStream::isEnd() const {
@@ -21,6 +21,7 @@ enum FileStreamType {
 enum FileStreamBehavior {
   Read,
   Write,
+  Update,
 };
 
 class File;
@@ -53,6 +54,11 @@ public:
   inline void openWrite(const FileStreamType streamType = FileStreamType::Binary) {
     this->open(FileStreamBehavior::Write, streamType);
   }
+  inline void openUpdate(const FileStreamType streamType = FileStreamType::Binary) {
+    this->open(FileStreamBehavior::Update, streamType);
+  }
+  // open an anonymous binary file for reading and writing, removed when closed
+  void openTemporary();
 
 	inline bool isOpened() const {
 		return this->fileHandler != NULL;
@@ -64,7 +70,9 @@ public:
 	bool readLine(char* lineBuffer, const int lineBufferSize) const;
   void writeText(const char* str) const;
 	
-	void flush() { }
+	void flush();
+	// flush and make the written data durable on disk
+	void sync();
   void close();
 	
 	size_t getLength() const;
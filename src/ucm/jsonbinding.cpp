@@ -0,0 +1,212 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "jsonbinding.h"
+
+namespace ucm {
+
+////////////////// JSONFieldTable //////////////////
+
+uint JSONFieldTable::hashKey(const char* key, const uint length, const uint seed) {
+	// FNV-1a from a seeded basis, mixed so that the low bits depend on every byte
+	uint hash = 2166136261U ^ (seed * 0x9e3779b9U);
+
+	for (uint i = 0; i < length; i++) {
+		hash ^= (byte)key[i];
+		hash *= 16777619U;
+	}
+
+	hash ^= hash >> 15;
+	hash *= 0x2c1b3c6dU;
+	hash ^= hash >> 12;
+	return hash;
+}
+
+void JSONFieldTable::add(const Field& field) {
+	for (Field& f : this->fields) {
+		if (f.length == field.length && memcmp(f.key, field.key, field.length) == 0) {
+			f = field;
+			return;
+		}
+	}
+
+	this->fields.push_back(field);
+}
+
+void JSONFieldTable::build() {
+	uint size = 1;
+	while (size < this->fields.size()) size *= 2;
+
+	// try a number of seeds for each table size, every doubling makes a collision free
+	// seed more likely
+	while (true) {
+		for (uint seed = 1; seed <= 64; seed++) {
+			this->slots.assign(size, 0);
+			bool collision = false;
+
+			for (size_t i = 0; i < this->fields.size() && !collision; i++) {
+				uint& slot = this->slots[hashKey(this->fields[i].key, this->fields[i].length, seed) & (size - 1)];
+
+				if (slot != 0) {
+					collision = true;
+				} else {
+					slot = (uint)i + 1;
+				}
+			}
+
+			if (!collision) {
+				this->seed = seed;
+				this->mask = size - 1;
+				return;
+			}
+		}
+
+		size *= 2;
+	}
+}
+
+const JSONFieldTable::Field* JSONFieldTable::find(const char* key, const uint length) const {
+	if (this->slots.empty()) {
+		return NULL;
+	}
+
+	const uint slot = this->slots[hashKey(key, length, this->seed) & this->mask];
+
+	if (slot == 0) {
+		return NULL;
+	}
+
+	const Field& field = this->fields[slot - 1];
+	return field.length == length && memcmp(field.key, key, length) == 0 ? &field : NULL;
+}
+
+////////////////// JSONBinder //////////////////
+
+JSONBinder::JSONBinder(void* value, const JSONTypeBinding* binding)
+: next(value), nextBinding(binding) {
+}
+
+bool JSONBinder::beginValue() {
+	if (this->skipDepth > 0) {
+		this->next = NULL;
+		return true;
+	}
+
+	if (this->frames.empty()) {
+		// only one value is read
+		if (this->rootRead) return false;
+		this->rootRead = true;
+		return true;
+	}
+
+	const Frame& frame = this->frames.back();
+
+	if (frame.binding->addElement != NULL) {
+		this->next = frame.binding->addElement(frame.value, &this->nextBinding);
+	}
+
+	return true;
+}
+
+bool JSONBinder::beginContainer(const bool array) {
+	if (!this->beginValue()) {
+		return false;
+	}
+
+	if (this->next == NULL) {
+		this->skipDepth++;
+		return true;
+	}
+
+	if (array) {
+		if (this->nextBinding->addElement == NULL) return false;
+		this->nextBinding->clearArray(this->next);
+	} else if (this->nextBinding->getField == NULL) {
+		return false;
+	}
+
+	Frame frame;
+	frame.value = this->next;
+	frame.binding = this->nextBinding;
+	this->frames.push_back(frame);
+
+	this->next = NULL;
+	return true;
+}
+
+bool JSONBinder::endContainer() {
+	if (this->skipDepth > 0) {
+		this->skipDepth--;
+	} else {
+		this->frames.pop_back();
+	}
+
+	this->next = NULL;
+	return true;
+}
+
+bool JSONBinder::onObjectBegin() {
+	return this->beginContainer(false);
+}
+
+bool JSONBinder::onObjectEnd() {
+	return this->endContainer();
+}
+
+bool JSONBinder::onArrayBegin() {
+	return this->beginContainer(true);
+}
+
+bool JSONBinder::onArrayEnd() {
+	return this->endContainer();
+}
+
+bool JSONBinder::onKey(const char* key, const int length) {
+	if (this->skipDepth == 0) {
+		const Frame& frame = this->frames.back();
+		this->next = frame.binding->getField(frame.value, key, length, &this->nextBinding);
+	}
+
+	return true;
+}
+
+bool JSONBinder::onString(const char* str, const int length) {
+	if (!this->beginValue()) return false;
+	if (this->next == NULL) return true;
+
+	const bool set = this->nextBinding->setString != NULL && this->nextBinding->setString(this->next, str, length);
+	this->next = NULL;
+	return set;
+}
+
+bool JSONBinder::onNumber(const double value) {
+	if (!this->beginValue()) return false;
+	if (this->next == NULL) return true;
+
+	const bool set = this->nextBinding->setNumber != NULL && this->nextBinding->setNumber(this->next, value);
+	this->next = NULL;
+	return set;
+}
+
+bool JSONBinder::onBoolean(const bool value) {
+	if (!this->beginValue()) return false;
+	if (this->next == NULL) return true;
+
+	const bool set = this->nextBinding->setBoolean != NULL && this->nextBinding->setBoolean(this->next, value);
+	this->next = NULL;
+	return set;
+}
+
+bool JSONBinder::onIdentifier(const char* name, const int length) {
+	if (!this->beginValue()) return false;
+	if (this->next == NULL) return true;
+
+	this->next = NULL;
+	return length == 4 && strncmp(name, "null", 4) == 0;
+}
+
+}
@@ -0,0 +1,447 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef jsonbinding_h
+#define jsonbinding_h
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+#include "string.h"
+#include "jsonreader.h"
+#include "jsonwriter.h"
+
+namespace ucm {
+
+// Reads and writes the values of one C++ type, type-erased so JSONBinder can walk nested
+// structs and vectors without knowing their types. Members a type does not support are
+// NULL, values of that kind do not fit it.
+struct JSONTypeBinding
+{
+	bool (*setNumber)(void* value, const double number);
+	bool (*setBoolean)(void* value, const bool b);
+	bool (*setString)(void* value, const char* str, const int length);
+
+	// the member bound to key of a struct, NULL for keys not in its schema
+	void* (*getField)(void* object, const char* key, const int length, const JSONTypeBinding** binding);
+
+	// empty a vector before reading it, append a default element to read into
+	void (*clearArray)(void* array);
+	void* (*addElement)(void* array, const JSONTypeBinding** binding);
+
+	void (*writeProperty)(JSONWriter& writer, const char* key, const void* value);
+	void (*writeElement)(JSONWriter& writer, const void* value);
+};
+
+// Fields of a struct schema by key. Keys are found with a perfect hash: the seed and table
+// size are chosen when the schema is built so that every key has a slot of its own, and
+// a lookup hashes the key once and compares it with the one field in its slot.
+class JSONFieldTable
+{
+public:
+	struct Field {
+		const char* key;
+		uint length;
+		const JSONTypeBinding* binding;
+
+		// the member of object, from the member pointer kept in member
+		void* (*access)(void* object, const Field& field);
+		char member[16];
+	};
+
+private:
+	std::vector<Field> fields;
+
+	// field index plus one per slot, 0 for free slots
+	std::vector<uint> slots;
+	uint seed = 0;
+	uint mask = 0;
+
+	static uint hashKey(const char* key, const uint length, const uint seed);
+
+public:
+	// a field with the key of an earlier one replaces it
+	void add(const Field& field);
+	void build();
+
+	const Field* find(const char* key, const uint length) const;
+
+	inline const std::vector<Field>& getFields() const {
+		return this->fields;
+	}
+};
+
+template<typename T>
+class JSONFields
+{
+private:
+	JSONFieldTable& table;
+
+	template<typename M>
+	static void* access(void* object, const JSONFieldTable::Field& field);
+
+public:
+	typedef T Object;
+
+	JSONFields(JSONFieldTable& table) : table(table) { }
+
+	// bind key to member, keys are not copied
+	template<typename M>
+	void add(const char* key, M T::*member);
+};
+
+// Schema of a struct, specialized for each struct with JSON_SCHEMA.
+template<typename T>
+struct JSONSchema
+{
+	static void describe(JSONFields<T>& fields);
+};
+
+// Declares the schema of Type, followed by a block of JSON_FIELD, for example
+//
+//   JSON_SCHEMA(Point) {
+//     JSON_FIELD(x);
+//     JSON_FIELD_KEY("y-coordinate", y);
+//   }
+//
+// Fields are written in the order they are listed. Members may be numbers, bool, string,
+// std::string, std::vector of those and structs with a schema.
+#define JSON_SCHEMA(Type) template<> inline void ucm::JSONSchema<Type>::describe(ucm::JSONFields<Type>& fields)
+#define JSON_FIELD(name) fields.add(#name, &std::remove_reference<decltype(fields)>::type::Object::name)
+#define JSON_FIELD_KEY(key, name) fields.add(key, &std::remove_reference<decltype(fields)>::type::Object::name)
+
+// the binding of structs with a JSONSchema
+template<typename T, typename Enable = void>
+struct JSONBinding
+{
+	static const JSONFieldTable& getTable() {
+		static const JSONFieldTable table = buildTable();
+		return table;
+	}
+
+	static JSONFieldTable buildTable() {
+		JSONFieldTable table;
+		JSONFields<T> fields(table);
+		JSONSchema<T>::describe(fields);
+		table.build();
+		return table;
+	}
+
+	static void* getField(void* object, const char* key, const int length, const JSONTypeBinding** binding) {
+		const JSONFieldTable::Field* field = getTable().find(key, (uint)length);
+		if (field == NULL) return NULL;
+
+		*binding = field->binding;
+		return field->access(object, *field);
+	}
+
+	static void writeFields(JSONWriter& writer, const void* value) {
+		for (const JSONFieldTable::Field& field : getTable().getFields()) {
+			field.binding->writeProperty(writer, field.key, field.access(const_cast<void*>(value), field));
+		}
+	}
+
+	static void writeProperty(JSONWriter& writer, const char* key, const void* value) {
+		writer.beginObjectWithKey(key);
+		writeFields(writer, value);
+		writer.endObject();
+	}
+
+	static void writeElement(JSONWriter& writer, const void* value) {
+		writer.beginObjectElement();
+		writeFields(writer, value);
+		writer.endObject();
+	}
+
+	static void writeValue(JSONWriter& writer, const T& value) {
+		writer.beginObject();
+		writeFields(writer, &value);
+		writer.endObject();
+	}
+
+	static const JSONTypeBinding* get() {
+		static const JSONTypeBinding binding = {
+			NULL, NULL, NULL, getField, NULL, NULL, writeProperty, writeElement,
+		};
+		return &binding;
+	}
+};
+
+template<typename T>
+struct JSONBinding<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+	// numbers whose conversion to an integral T is defined, NaN fails both comparisons
+	static bool fits(const double number, std::true_type) {
+		const double limit = ldexp(1.0, std::numeric_limits<T>::digits);
+		return number >= (std::is_signed<T>::value ? -limit : 0.0) && number < limit;
+	}
+
+	// infinity and NaN convert to any floating type, other numbers must be within its range
+	static bool fits(const double number, std::false_type) {
+		return !(fabs(number) > std::numeric_limits<T>::max()) || isinf(number);
+	}
+
+	// integers in full, floating numbers with the digits needed to read them back unchanged;
+	// JSON has no infinity or NaN, those are written as null
+	static string format(const T value, std::true_type) {
+		char buffer[32];
+		if (std::is_signed<T>::value) {
+			snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+		} else {
+			snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)value);
+		}
+		return string(buffer);
+	}
+
+	static string format(const T value, std::false_type) {
+		if (!isfinite((double)value)) return string("null");
+
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.*g", std::numeric_limits<T>::max_digits10, (double)value);
+		return string(buffer);
+	}
+
+	static bool setNumber(void* value, const double number) {
+		if (!fits(number, std::is_integral<T>())) return false;
+
+		*(T*)value = (T)number;
+		return true;
+	}
+
+	static void writeProperty(JSONWriter& writer, const char* key, const void* value) {
+		writer.writeCustomProperty(key, format(*(const T*)value, std::is_integral<T>()));
+	}
+
+	static void writeElement(JSONWriter& writer, const void* value) {
+		writer.writeArrayElement(format(*(const T*)value, std::is_integral<T>()));
+	}
+
+	static const JSONTypeBinding* get() {
+		static const JSONTypeBinding binding = {
+			setNumber, NULL, NULL, NULL, NULL, NULL, writeProperty, writeElement,
+		};
+		return &binding;
+	}
+};
+
+template<>
+struct JSONBinding<bool>
+{
+	static bool setBoolean(void* value, const bool b) {
+		*(bool*)value = b;
+		return true;
+	}
+
+	static void writeProperty(JSONWriter& writer, const char* key, const void* value) {
+		writer.writeProperty(key, *(const bool*)value);
+	}
+
+	static void writeElement(JSONWriter& writer, const void* value) {
+		writer.writeArrayElementBoolean(*(const bool*)value);
+	}
+
+	static const JSONTypeBinding* get() {
+		static const JSONTypeBinding binding = {
+			NULL, setBoolean, NULL, NULL, NULL, NULL, writeProperty, writeElement,
+		};
+		return &binding;
+	}
+};
+
+template<>
+struct JSONBinding<string>
+{
+	static bool setString(void* value, const char* str, const int length) {
+		string* s = (string*)value;
+		s->clear();
+		s->append(str, length);
+		return true;
+	}
+
+	static void writeProperty(JSONWriter& writer, const char* key, const void* value) {
+		writer.writeProperty(key, *(const string*)value);
+	}
+
+	static void writeElement(JSONWriter& writer, const void* value) {
+		writer.writeArrayElementString(*(const string*)value);
+	}
+
+	static const JSONTypeBinding* get() {
+		static const JSONTypeBinding binding = {
+			NULL, NULL, setString, NULL, NULL, NULL, writeProperty, writeElement,
+		};
+		return &binding;
+	}
+};
+
+template<>
+struct JSONBinding<std::string>
+{
+	static bool setString(void* value, const char* str, const int length) {
+		((std::string*)value)->assign(str, length);
+		return true;
+	}
+
+	static void writeProperty(JSONWriter& writer, const char* key, const void* value) {
+		const std::string* s = (const std::string*)value;
+		writer.writeProperty(key, string(s->data(), (int)s->length()));
+	}
+
+	static void writeElement(JSONWriter& writer, const void* value) {
+		const std::string* s = (const std::string*)value;
+		writer.writeArrayElementString(string(s->data(), (int)s->length()));
+	}
+
+	static const JSONTypeBinding* get() {
+		static const JSONTypeBinding binding = {
+			NULL, NULL, setString, NULL, NULL, NULL, writeProperty, writeElement,
+		};
+		return &binding;
+	}
+};
+
+template<typename E>
+struct JSONBinding<std::vector<E>>
+{
+	static_assert(!std::is_same<E, bool>::value, "std::vector<bool> has no element addresses to read into");
+
+	static void clearArray(void* array) {
+		((std::vector<E>*)array)->clear();
+	}
+
+	static void* addElement(void* array, const JSONTypeBinding** binding) {
+		std::vector<E>* v = (std::vector<E>*)array;
+		v->push_back(E());
+
+		*binding = JSONBinding<E>::get();
+		return &v->back();
+	}
+
+	static void writeElements(JSONWriter& writer, const void* value) {
+		const JSONTypeBinding* binding = JSONBinding<E>::get();
+
+		for (const E& e : *(const std::vector<E>*)value) {
+			binding->writeElement(writer, &e);
+		}
+	}
+
+	static void writeProperty(JSONWriter& writer, const char* key, const void* value) {
+		writer.beginArrayWithKey(key);
+		writeElements(writer, value);
+		writer.endArray();
+	}
+
+	static void writeElement(JSONWriter& writer, const void* value) {
+		writer.beginArrayElement();
+		writeElements(writer, value);
+		writer.endArray();
+	}
+
+	static void writeValue(JSONWriter& writer, const std::vector<E>& value) {
+		writer.beginArray();
+		writeElements(writer, &value);
+		writer.endArray();
+	}
+
+	static const JSONTypeBinding* get() {
+		static const JSONTypeBinding binding = {
+			NULL, NULL, NULL, NULL, clearArray, addElement, writeProperty, writeElement,
+		};
+		return &binding;
+	}
+};
+
+template<typename T>
+template<typename M>
+void* JSONFields<T>::access(void* object, const JSONFieldTable::Field& field) {
+	M T::*member;
+	memcpy(&member, field.member, sizeof(member));
+	return &(((T*)object)->*member);
+}
+
+template<typename T>
+template<typename M>
+void JSONFields<T>::add(const char* key, M T::*member) {
+	static_assert(sizeof(member) <= sizeof(JSONFieldTable::Field::member), "member pointer too large");
+
+	JSONFieldTable::Field field;
+	field.key = key;
+	field.length = (uint)strlen(key);
+	field.binding = JSONBinding<M>::get();
+	field.access = access<M>;
+	memcpy(field.member, &member, sizeof(member));
+
+	this->table.add(field);
+}
+
+// Handler for JSONReader::parse that stores the values of a document straight into a
+// struct or vector bound by JSONBinding. Keys outside the schema are skipped, null
+// leaves the field as it is, other values that do not fit their field fail the parse.
+class JSONBinder : public JSONHandler
+{
+private:
+	struct Frame {
+		void* value;
+		const JSONTypeBinding* binding;
+	};
+
+	std::vector<Frame> frames;
+
+	// where the next value goes, NULL to skip it
+	void* next = NULL;
+	const JSONTypeBinding* nextBinding = NULL;
+
+	// containers open inside a skipped value
+	uint skipDepth = 0;
+	bool rootRead = false;
+
+	bool beginValue();
+	bool beginContainer(const bool array);
+	bool endContainer();
+
+public:
+	JSONBinder(void* value, const JSONTypeBinding* binding);
+
+	// true once a whole value is read
+	inline bool isComplete() const {
+		return this->rootRead && this->frames.empty();
+	}
+
+	bool onObjectBegin();
+	bool onObjectEnd();
+	bool onArrayBegin();
+	bool onArrayEnd();
+
+	bool onKey(const char* key, const int length);
+	bool onString(const char* str, const int length);
+	bool onNumber(const double value);
+	bool onBoolean(const bool value);
+	bool onIdentifier(const char* name, const int length);
+};
+
+// read one value of reader into value, a struct with a JSONSchema or a std::vector;
+// members missing from the input keep their values
+template<typename T>
+bool readJSON(JSONReader& reader, T& value) {
+	JSONBinder binder(&value, JSONBinding<T>::get());
+	return reader.parse(binder) && binder.isComplete();
+}
+
+// write a struct with a JSONSchema or a std::vector
+template<typename T>
+void writeJSON(JSONWriter& writer, const T& value) {
+	JSONBinding<T>::writeValue(writer, value);
+}
+
+}
+
+#endif /* jsonbinding_h */
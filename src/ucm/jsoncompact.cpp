@@ -0,0 +1,356 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "jsoncompact.h"
+
+namespace ucm {
+
+// values other than numbers are NaNs with one of these tags in bits 48 to 50
+enum CompactTag {
+	CT_Number = 0,
+	CT_String,
+	CT_Identifier,
+	CT_Boolean,
+	CT_Array,
+	CT_Object,
+};
+
+static const uint64_t TagPrefix = 0xFFF8000000000000ULL;
+static const uint64_t PayloadMask = 0x0000FFFFFFFFFFFFULL;
+
+// the NaN numbers are stored as, never mistaken for a tagged value
+static const uint64_t CanonicalNaN = 0x7FF8000000000000ULL;
+
+static inline uint64_t boxValue(const uint tag, const uint64_t payload) {
+	return TagPrefix | (uint64_t)tag << 48 | payload;
+}
+
+static inline uint64_t boxNumber(const double value) {
+	if (value != value) {
+		return CanonicalNaN;
+	}
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+////////////////// JSCompactValue //////////////////
+
+uint JSCompactValue::getTag() const {
+	return (this->bits >> 48) > 0xFFF8 ? (uint)((this->bits >> 48) & 0x7) : (uint)CT_Number;
+}
+
+uint64_t JSCompactValue::getPayload() const {
+	return this->bits & PayloadMask;
+}
+
+const uint64_t* JSCompactValue::getItems() const {
+	return this->document->values.data() + this->getPayload();
+}
+
+JSType JSCompactValue::getType() const {
+	if (this->document == NULL) {
+		return JSType::JSType_Unknown;
+	}
+
+	switch (this->getTag()) {
+		case CT_Number: return JSType::JSType_Number;
+		case CT_String: return JSType::JSType_String;
+		case CT_Identifier: return JSType::JSType_Identifier;
+		case CT_Boolean: return JSType::JSType_Boolean;
+		case CT_Array: return JSType::JSType_Array;
+		case CT_Object: return JSType::JSType_Object;
+		default: return JSType::JSType_Unknown;
+	}
+}
+
+double JSCompactValue::getNumber(const double defValue) const {
+	if (this->document == NULL || this->getTag() != CT_Number) {
+		return defValue;
+	}
+
+	double value;
+	memcpy(&value, &this->bits, sizeof(value));
+	return value;
+}
+
+bool JSCompactValue::getBoolean(const bool defValue) const {
+	if (this->document == NULL || this->getTag() != CT_Boolean) {
+		return defValue;
+	}
+
+	return this->getPayload() != 0;
+}
+
+const char* JSCompactValue::getString() const {
+	if (this->document == NULL) {
+		return NULL;
+	}
+
+	const uint tag = this->getTag();
+
+	if (tag != CT_String && tag != CT_Identifier) {
+		return NULL;
+	}
+
+	return this->document->strings.data() + this->getPayload() + sizeof(uint32_t);
+}
+
+uint JSCompactValue::getStringLength() const {
+	if (this->document == NULL) {
+		return 0;
+	}
+
+	const uint tag = this->getTag();
+
+	if (tag != CT_String && tag != CT_Identifier) {
+		return 0;
+	}
+
+	uint32_t length;
+	memcpy(&length, this->document->strings.data() + this->getPayload(), sizeof(length));
+	return length;
+}
+
+uint JSCompactValue::getLength() const {
+	if (this->document == NULL) {
+		return 0;
+	}
+
+	const uint tag = this->getTag();
+
+	if (tag != CT_Array && tag != CT_Object) {
+		return 0;
+	}
+
+	return (uint)this->getItems()[0];
+}
+
+JSCompactValue JSCompactValue::getElement(const uint index) const {
+	if (this->document == NULL || this->getTag() != CT_Array) {
+		return JSCompactValue();
+	}
+
+	const uint64_t* items = this->getItems();
+
+	if (index >= items[0]) {
+		return JSCompactValue();
+	}
+
+	return JSCompactValue(this->document, items[1 + index]);
+}
+
+const char* JSCompactValue::getKey(const uint index) const {
+	if (this->document == NULL || this->getTag() != CT_Object) {
+		return NULL;
+	}
+
+	const uint64_t* items = this->getItems();
+
+	if (index >= items[0]) {
+		return NULL;
+	}
+
+	return JSCompactValue(this->document, items[1 + index * 2]).getString();
+}
+
+JSCompactValue JSCompactValue::getValue(const uint index) const {
+	if (this->document == NULL || this->getTag() != CT_Object) {
+		return JSCompactValue();
+	}
+
+	const uint64_t* items = this->getItems();
+
+	if (index >= items[0]) {
+		return JSCompactValue();
+	}
+
+	return JSCompactValue(this->document, items[2 + index * 2]);
+}
+
+JSCompactValue JSCompactValue::getProperty(const char* key) const {
+	if (this->document == NULL || this->getTag() != CT_Object) {
+		return JSCompactValue();
+	}
+
+	const uint64_t* items = this->getItems();
+	const char* strings = this->document->strings.data();
+	const uint32_t length = (uint32_t)strlen(key);
+
+	for (uint64_t i = items[0]; i > 0; i--) {
+		const char* entry = strings + (items[i * 2 - 1] & PayloadMask);
+
+		uint32_t entryLength;
+		memcpy(&entryLength, entry, sizeof(entryLength));
+
+		if (entryLength == length && memcmp(entry + sizeof(uint32_t), key, length) == 0) {
+			return JSCompactValue(this->document, items[i * 2]);
+		}
+	}
+
+	return JSCompactValue();
+}
+
+JSValue JSCompactValue::toJSValue() const {
+	switch (this->getType()) {
+		case JSType::JSType_Number:
+			return JSValue(this->getNumber());
+
+		case JSType::JSType_Boolean:
+			return JSValue(this->getBoolean());
+
+		case JSType::JSType_String:
+		case JSType::JSType_Identifier:
+		{
+			JSValue value(this->getType());
+			value.str = new string(this->getString(), (int)this->getStringLength());
+			return value;
+		}
+
+		case JSType::JSType_Array:
+		{
+			const uint length = this->getLength();
+			std::vector<JSValue>* array = new std::vector<JSValue>();
+			array->reserve(length);
+
+			for (uint i = 0; i < length; i++) {
+				array->push_back(this->getElement(i).toJSValue());
+			}
+
+			return JSValue(array);
+		}
+
+		case JSType::JSType_Object:
+		{
+			const uint length = this->getLength();
+			JSObject* object = new JSObject();
+
+			for (uint i = 0; i < length; i++) {
+				const JSCompactValue key(this->document, this->getItems()[1 + i * 2]);
+				object->setProperty(string(key.getString(), (int)key.getStringLength()), this->getValue(i).toJSValue());
+			}
+
+			return JSValue(object);
+		}
+
+		default:
+			return JSValue();
+	}
+}
+
+////////////////// JSONCompactDocument //////////////////
+
+JSCompactValue JSONCompactDocument::getRoot() const {
+	return this->loaded ? JSCompactValue(this, this->root) : JSCompactValue();
+}
+
+void JSONCompactDocument::clear() {
+	// the buffers keep their memory for the next document
+	this->values.clear();
+	this->strings.clear();
+	this->root = 0;
+	this->loaded = false;
+}
+
+////////////////// JSONCompactBuilder //////////////////
+
+JSONCompactBuilder::JSONCompactBuilder(JSONCompactDocument& document)
+: document(document) {
+	this->document.clear();
+}
+
+uint64_t JSONCompactBuilder::addString(const uint tag, const char* str, const int length) {
+	std::vector<char>& strings = this->document.strings;
+	const size_t offset = strings.size();
+	const uint32_t n = (uint32_t)length;
+
+	strings.resize(offset + sizeof(n) + n + 1);
+	memcpy(strings.data() + offset, &n, sizeof(n));
+	if (n > 0) memcpy(strings.data() + offset + sizeof(n), str, n);
+	strings[offset + sizeof(n) + n] = '\0';
+
+	return boxValue(tag, offset);
+}
+
+bool JSONCompactBuilder::close(const uint tag, const size_t step) {
+	if (this->scopes.empty()) {
+		return false;
+	}
+
+	const size_t start = this->scopes.back();
+	this->scopes.pop_back();
+
+	// the values of the container are moved from the stack into one span
+	std::vector<uint64_t>& values = this->document.values;
+	const size_t offset = values.size();
+
+	values.push_back((this->stack.size() - start) / step);
+	values.insert(values.end(), this->stack.begin() + start, this->stack.end());
+
+	this->stack.resize(start);
+	this->stack.push_back(boxValue(tag, offset));
+	return true;
+}
+
+bool JSONCompactBuilder::onObjectBegin() {
+	this->scopes.push_back(this->stack.size());
+	return true;
+}
+
+bool JSONCompactBuilder::onObjectEnd() {
+	return this->close(CT_Object, 2);
+}
+
+bool JSONCompactBuilder::onArrayBegin() {
+	this->scopes.push_back(this->stack.size());
+	return true;
+}
+
+bool JSONCompactBuilder::onArrayEnd() {
+	return this->close(CT_Array, 1);
+}
+
+bool JSONCompactBuilder::onKey(const char* key, const int length) {
+	this->stack.push_back(this->addString(CT_String, key, length));
+	return true;
+}
+
+bool JSONCompactBuilder::onString(const char* str, const int length) {
+	this->stack.push_back(this->addString(CT_String, str, length));
+	return true;
+}
+
+bool JSONCompactBuilder::onNumber(const double value) {
+	this->stack.push_back(boxNumber(value));
+	return true;
+}
+
+bool JSONCompactBuilder::onBoolean(const bool value) {
+	this->stack.push_back(boxValue(CT_Boolean, value ? 1 : 0));
+	return true;
+}
+
+bool JSONCompactBuilder::onIdentifier(const char* name, const int length) {
+	this->stack.push_back(this->addString(CT_Identifier, name, length));
+	return true;
+}
+
+bool JSONCompactBuilder::finish() {
+	if (!this->scopes.empty() || this->stack.size() != 1) {
+		return false;
+	}
+
+	this->document.root = this->stack[0];
+	this->document.loaded = true;
+	this->stack.clear();
+	return true;
+}
+
+}
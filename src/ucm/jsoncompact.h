@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef jsoncompact_h
+#define jsoncompact_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "jstypes.h"
+#include "jsonreader.h"
+
+namespace ucm {
+
+class JSONCompactDocument;
+class JSONCompactBuilder;
+
+// A value of a JSONCompactDocument. The document stores every value in 8 bytes: numbers
+// as doubles, everything else in the payload bits of a NaN, where strings, arrays and
+// objects are offsets into the buffers of the document. Valid as long as the document
+// is not cleared or read into again.
+class JSCompactValue
+{
+	friend JSONCompactDocument;
+
+private:
+	const JSONCompactDocument* document = NULL;
+	uint64_t bits = 0;
+
+	JSCompactValue(const JSONCompactDocument* document, const uint64_t bits)
+	: document(document), bits(bits) { }
+
+	uint getTag() const;
+	uint64_t getPayload() const;
+	const uint64_t* getItems() const;
+
+public:
+	// a value of type JSType_Unknown
+	JSCompactValue() { }
+
+	JSType getType() const;
+
+	inline bool isValid() const {
+		return this->document != NULL;
+	}
+
+	double getNumber(const double defValue = 0) const;
+	bool getBoolean(const bool defValue = false) const;
+
+	// text of a string or identifier, such as null, NULL for other values
+	const char* getString() const;
+	uint getStringLength() const;
+
+	// number of elements of an array or properties of an object, 0 for other values
+	uint getLength() const;
+
+	JSCompactValue getElement(const uint index) const;
+
+	// the key and value of property index of an object
+	const char* getKey(const uint index) const;
+	JSCompactValue getValue(const uint index) const;
+
+	// value of key, the last of duplicate keys; a JSType_Unknown value if there is none
+	JSCompactValue getProperty(const char* key) const;
+
+	// copy into a JSValue, owned by the caller like the values JSONReader reads
+	JSValue toJSValue() const;
+};
+
+// Values read by JSONReader::readCompact. Each array and object is one contiguous span of
+// values and all strings share one buffer, so the document is a few allocations however
+// large it is and walking it reads memory in order.
+class JSONCompactDocument
+{
+	friend JSCompactValue;
+	friend JSONCompactBuilder;
+
+private:
+	// arrays as their length followed by the elements, objects as their number of
+	// properties followed by key and value of each
+	std::vector<uint64_t> values;
+
+	// strings as their 32-bit length followed by the text and a terminating null
+	std::vector<char> strings;
+
+	uint64_t root = 0;
+	bool loaded = false;
+
+public:
+	JSCompactValue getRoot() const;
+
+	void clear();
+
+	// bytes used by values and strings
+	inline size_t getSize() const {
+		return this->values.size() * sizeof(uint64_t) + this->strings.size();
+	}
+};
+
+// Builds a JSONCompactDocument from the values reported to a JSONHandler.
+class JSONCompactBuilder : public JSONHandler
+{
+private:
+	JSONCompactDocument& document;
+
+	// values of the arrays and objects not closed yet, and where each of them starts
+	std::vector<uint64_t> stack;
+	std::vector<size_t> scopes;
+
+	uint64_t addString(const uint tag, const char* str, const int length);
+	bool close(const uint tag, const size_t step);
+
+public:
+	// clears document
+	JSONCompactBuilder(JSONCompactDocument& document);
+
+	bool onObjectBegin();
+	bool onObjectEnd();
+	bool onArrayBegin();
+	bool onArrayEnd();
+
+	bool onKey(const char* key, const int length);
+	bool onString(const char* str, const int length);
+	bool onNumber(const double value);
+	bool onBoolean(const bool value);
+	bool onIdentifier(const char* name, const int length);
+
+	// completes the document after a whole value is reported, false if none is
+	bool finish();
+};
+
+}
+
+#endif /* jsoncompact_h */
@@ -0,0 +1,266 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "jsonindex.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define JSONINDEX_X86
+#define JSONINDEX_AVX2_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define JSONINDEX_X86
+#define JSONINDEX_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace ucm {
+
+enum CharClass {
+	CC_Quote = 0x1,
+	CC_Backslash = 0x2,
+	CC_Whitespace = 0x4,
+	CC_Operator = 0x8,
+	// comments and single quoted strings, left to the Lexer
+	CC_Unsupported = 0x10,
+};
+
+// one bit per byte of a 64 byte block
+struct BlockMasks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t whitespace;
+	uint64_t op;
+	uint64_t unsupported;
+};
+
+struct CharClassTable {
+	byte classes[256];
+
+	CharClassTable() {
+		memset(this->classes, 0, sizeof(this->classes));
+
+		this->classes['"'] = CC_Quote;
+		this->classes['\\'] = CC_Backslash;
+		this->classes[' '] = this->classes['\t'] = this->classes['\r'] = this->classes['\n'] = CC_Whitespace;
+		this->classes['{'] = this->classes['}'] = this->classes['['] = this->classes[']'] = CC_Operator;
+		this->classes[':'] = this->classes[','] = CC_Operator;
+		this->classes['/'] = this->classes['\''] = CC_Unsupported;
+	}
+};
+
+static void classifyBlock(const char* p, BlockMasks& m) {
+	static const CharClassTable table;
+
+	memset(&m, 0, sizeof(m));
+
+	for (int i = 0; i < 64; i++) {
+		const uint64_t c = table.classes[(byte)p[i]];
+
+		m.quote |= (c & 1) << i;
+		m.backslash |= ((c >> 1) & 1) << i;
+		m.whitespace |= ((c >> 2) & 1) << i;
+		m.op |= ((c >> 3) & 1) << i;
+		m.unsupported |= ((c >> 4) & 1) << i;
+	}
+}
+
+#if defined(JSONINDEX_X86)
+
+JSONINDEX_AVX2_TARGET static inline uint64_t getByteMask(const __m256i lo, const __m256i hi) {
+	return (uint64_t)(uint)_mm256_movemask_epi8(lo) | ((uint64_t)(uint)_mm256_movemask_epi8(hi) << 32);
+}
+
+JSONINDEX_AVX2_TARGET static void classifyBlockAVX2(const char* p, BlockMasks& m) {
+	const __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+	const __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+
+#define JSONINDEX_EQ(v, ch) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch))
+
+	m.quote = getByteMask(JSONINDEX_EQ(lo, '"'), JSONINDEX_EQ(hi, '"'));
+	m.backslash = getByteMask(JSONINDEX_EQ(lo, '\\'), JSONINDEX_EQ(hi, '\\'));
+
+	m.whitespace = getByteMask(
+		_mm256_or_si256(_mm256_or_si256(JSONINDEX_EQ(lo, ' '), JSONINDEX_EQ(lo, '\t')),
+										_mm256_or_si256(JSONINDEX_EQ(lo, '\r'), JSONINDEX_EQ(lo, '\n'))),
+		_mm256_or_si256(_mm256_or_si256(JSONINDEX_EQ(hi, ' '), JSONINDEX_EQ(hi, '\t')),
+										_mm256_or_si256(JSONINDEX_EQ(hi, '\r'), JSONINDEX_EQ(hi, '\n'))));
+
+	// '[' and ']' differ from '{' and '}' only by 0x20
+	const __m256i lo20 = _mm256_or_si256(lo, _mm256_set1_epi8(0x20));
+	const __m256i hi20 = _mm256_or_si256(hi, _mm256_set1_epi8(0x20));
+
+	m.op = getByteMask(
+		_mm256_or_si256(_mm256_or_si256(JSONINDEX_EQ(lo20, '{'), JSONINDEX_EQ(lo20, '}')),
+										_mm256_or_si256(JSONINDEX_EQ(lo, ':'), JSONINDEX_EQ(lo, ','))),
+		_mm256_or_si256(_mm256_or_si256(JSONINDEX_EQ(hi20, '{'), JSONINDEX_EQ(hi20, '}')),
+										_mm256_or_si256(JSONINDEX_EQ(hi, ':'), JSONINDEX_EQ(hi, ','))));
+
+	m.unsupported = getByteMask(
+		_mm256_or_si256(JSONINDEX_EQ(lo, '/'), JSONINDEX_EQ(lo, '\'')),
+		_mm256_or_si256(JSONINDEX_EQ(hi, '/'), JSONINDEX_EQ(hi, '\'')));
+
+#undef JSONINDEX_EQ
+}
+
+#endif /* JSONINDEX_X86 */
+
+bool JSONStructuralIndex::isAVX2Supported() {
+#if defined(JSONINDEX_X86)
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	// the OS must save the AVX registers
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif /* _MSC_VER */
+#else
+	return false;
+#endif /* JSONINDEX_X86 */
+}
+
+static inline int countTrailingZeros(const uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long i;
+	_BitScanForward64(&i, x);
+	return (int)i;
+#elif defined(_MSC_VER)
+	unsigned long i;
+	if (_BitScanForward(&i, (unsigned long)x)) return (int)i;
+	_BitScanForward(&i, (unsigned long)(x >> 32));
+	return (int)i + 32;
+#else
+	return __builtin_ctzll(x);
+#endif /* _MSC_VER */
+}
+
+// characters escaped by a backslash, the first of an odd run of backslashes escapes the
+// character after the run; prevEscaped carries an escape over into the next block
+static inline uint64_t findEscaped(uint64_t backslash, uint64_t& prevEscaped) {
+	const uint64_t evenBits = 0x5555555555555555ULL;
+
+	backslash &= ~prevEscaped;
+	const uint64_t followsEscape = backslash << 1 | prevEscaped;
+
+	// adding the starts of runs on odd positions to the backslashes carries through those
+	// runs, which flips the even/odd pattern for the character following each of them
+	const uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+	const uint64_t sequencesOnEvenBits = oddStarts + backslash;
+	prevEscaped = sequencesOnEvenBits < oddStarts ? 1 : 0;
+
+	const uint64_t invertMask = sequencesOnEvenBits << 1;
+	return (evenBits ^ invertMask) & followsEscape;
+}
+
+// bit i is set when an odd number of bits up to and including i are set
+static inline uint64_t prefixXor(uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+bool JSONStructuralIndex::build(const char* data, const size_t length) {
+	static const bool avx2 = isAVX2Supported();
+
+	this->count = 0;
+
+	if (length >= 0xffffffffU) {
+		return false;
+	}
+
+	if (this->positions.size() < length / 8 + 64) {
+		this->positions.resize(length / 8 + 64);
+	}
+
+	uint64_t prevEscaped = 0;
+	uint64_t prevInString = 0;
+	uint64_t prevAtom = 0;
+
+	BlockMasks m;
+	char tail[64];
+
+	for (size_t offset = 0; offset < length; offset += 64) {
+		const char* block = data + offset;
+
+		// the last block is padded with whitespace
+		if (length - offset < 64) {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, block, length - offset);
+			block = tail;
+		}
+
+#if defined(JSONINDEX_X86)
+		if (avx2) {
+			classifyBlockAVX2(block, m);
+		} else {
+			classifyBlock(block, m);
+		}
+#else
+		classifyBlock(block, m);
+#endif /* JSONINDEX_X86 */
+
+		const uint64_t quote = m.quote & ~findEscaped(m.backslash, prevEscaped);
+
+		// strings run from an opening quote up to the closing quote, which is not included
+		const uint64_t inString = prefixXor(quote) ^ prevInString;
+		prevInString = (uint64_t)((int64_t)inString >> 63);
+
+		const uint64_t outside = ~(inString | quote);
+
+		if ((m.unsupported & outside) != 0) {
+			return false;
+		}
+
+		// numbers, literals and unquoted keys start after a non-atom character
+		const uint64_t atom = outside & ~m.whitespace & ~m.op;
+		const uint64_t atomStart = atom & ~(atom << 1 | prevAtom);
+		prevAtom = atom >> 63;
+
+		uint64_t structural = (m.op & outside) | quote | atomStart;
+
+		if (this->count + 64 > this->positions.size()) {
+			this->positions.resize(this->positions.size() * 2);
+		}
+
+		uint* out = this->positions.data() + this->count;
+
+		while (structural != 0) {
+			*out++ = (uint)offset + countTrailingZeros(structural);
+			structural &= structural - 1;
+		}
+
+		this->count = out - this->positions.data();
+	}
+
+	return prevInString == 0;
+}
+
+void JSONStructuralIndex::trim() {
+	this->positions.resize(this->count);
+	this->positions.shrink_to_fit();
+}
+
+void JSONStructuralIndex::clear() {
+	this->positions.clear();
+	this->positions.shrink_to_fit();
+	this->count = 0;
+}
+
+}
@@ -0,0 +1,47 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef jsonindex_h
+#define jsonindex_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "types.h"
+
+namespace ucm {
+
+// Positions of the structural characters of a JSON document: brackets, colons and commas
+// outside strings, both quotes of every string and the first character of every other
+// value or unquoted key. The input is classified 64 bytes at a time, with AVX2 when the
+// CPU has it.
+class JSONStructuralIndex
+{
+private:
+	std::vector<uint> positions;
+	size_t count = 0;
+
+public:
+	// index length bytes of data, false when data has a string without closing quote or
+	// uses comments or single quoted strings, which only the Lexer reads; documents of
+	// 4 GB and more are not indexed either
+	bool build(const char* data, const size_t length);
+
+	inline const uint* getPositions() const { return this->positions.data(); }
+	inline size_t getCount() const { return this->count; }
+
+	// release the memory reserved for more positions
+	void trim();
+	void clear();
+
+	static bool isAVX2Supported();
+};
+
+}
+
+#endif /* jsonindex_h */
@@ -0,0 +1,529 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "jsonpath.h"
+
+namespace ucm {
+
+////////////////// JSONPath //////////////////
+
+JSONPath::JSONPath(const char* path) {
+	this->compile(path);
+}
+
+bool JSONPath::compile(const char* path) {
+	this->segments.clear();
+	this->wildcards = false;
+
+	if (path[0] == '\0' || path[0] == '/') {
+		this->valid = this->compilePointer(path);
+	} else {
+		this->valid = this->compilePath(path);
+	}
+
+	if (!this->valid) {
+		this->segments.clear();
+	}
+
+	return this->valid;
+}
+
+void JSONPath::addSegment(const char* key, const uint length, const bool wildcard) {
+	Segment segment;
+	segment.key.append(key, (int)length);
+	segment.hash = JSPropertyTable::hashKey(key, length);
+	segment.wildcard = wildcard;
+	this->wildcards |= wildcard;
+
+	// digits without leading zeros also select an element of arrays
+	if (length > 0 && length <= 9 && (key[0] != '0' || length == 1)) {
+		int index = 0;
+		uint i = 0;
+
+		while (i < length && key[i] >= '0' && key[i] <= '9') {
+			index = index * 10 + (key[i++] - '0');
+		}
+
+		if (i == length) {
+			segment.index = index;
+		}
+	}
+
+	this->segments.push_back(segment);
+}
+
+bool JSONPath::compilePointer(const char* path) {
+	string key;
+	const char* p = path;
+
+	while (*p == '/') {
+		p++;
+		key.clear();
+
+		while (*p != '\0' && *p != '/') {
+			if (*p == '~') {
+				if (p[1] == '0') key.append('~');
+				else if (p[1] == '1') key.append('/');
+				else return false;
+
+				p += 2;
+			} else {
+				key.append(*p++);
+			}
+		}
+
+		this->addSegment(key.getBuffer(), key.length());
+	}
+
+	return *p == '\0';
+}
+
+bool JSONPath::compilePath(const char* path) {
+	string key;
+	const char* p = path;
+
+	// the root may be left out, as in a.b[3]
+	bool name = *p != '$';
+	if (!name) p++;
+
+	while (*p != '\0') {
+		if (*p == '.' || name) {
+			if (*p == '.') p++;
+			name = false;
+
+			if (*p == '*') {
+				this->addSegment("", 0, true);
+				p++;
+				continue;
+			}
+
+			const char* start = p;
+			while (*p != '\0' && *p != '.' && *p != '[') p++;
+
+			if (p == start) {
+				return false;
+			}
+
+			this->addSegment(start, (uint)(p - start));
+		}
+		else if (*p == '[') {
+			p++;
+
+			if (*p == '*' && p[1] == ']') {
+				this->addSegment("", 0, true);
+				p += 2;
+			}
+			else if (*p == '\'' || *p == '"') {
+				const char quote = *p++;
+				key.clear();
+
+				while (*p != '\0' && *p != quote) {
+					if (*p == '\\' && p[1] != '\0') p++;
+					key.append(*p++);
+				}
+
+				if (*p != quote || p[1] != ']') {
+					return false;
+				}
+
+				this->addSegment(key.getBuffer(), key.length());
+				p += 2;
+			}
+			else {
+				const char* start = p;
+				while (*p >= '0' && *p <= '9') p++;
+
+				if (p == start || *p != ']') {
+					return false;
+				}
+
+				this->addSegment(start, (uint)(p - start));
+				p++;
+			}
+		}
+		else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool JSONPath::matches(const size_t segment, const char* key, const uint length) const {
+	const Segment& s = this->segments[segment];
+
+	return s.wildcard || ((uint)s.key.length() == length
+		&& (length == 0 || memcmp(s.key.getBuffer(), key, length) == 0));
+}
+
+bool JSONPath::matches(const size_t segment, const uint index) const {
+	const Segment& s = this->segments[segment];
+	return s.wildcard || s.index == (int)index;
+}
+
+bool JSONPath::evaluate(const JSValue& value, const size_t segment, std::vector<JSValue>* results, JSValue* first) const {
+	if (segment == this->segments.size()) {
+		if (results != NULL) {
+			results->push_back(value);
+			return false;
+		}
+
+		*first = value;
+		return true;
+	}
+
+	const Segment& s = this->segments[segment];
+
+	if (value.type == JSType::JSType_Object && value.object != NULL) {
+		if (s.wildcard) {
+			for (const auto& p : value.object->getProperties()) {
+				if (this->evaluate(p.second, segment + 1, results, first)) return true;
+			}
+
+			return false;
+		}
+
+		const JSValue* child = value.object->findProperty(s.key.getBuffer(), s.key.length(), s.hash);
+		return child != NULL && this->evaluate(*child, segment + 1, results, first);
+	}
+
+	if (value.type == JSType::JSType_Array && value.array != NULL) {
+		if (s.wildcard) {
+			for (const auto& e : *value.array) {
+				if (this->evaluate(e, segment + 1, results, first)) return true;
+			}
+
+			return false;
+		}
+
+		return s.index >= 0 && (size_t)s.index < value.array->size()
+			&& this->evaluate((*value.array)[s.index], segment + 1, results, first);
+	}
+
+	return false;
+}
+
+JSValue JSONPath::evaluate(const JSValue& value) const {
+	JSValue result;
+
+	if (!this->valid) {
+		return result;
+	}
+
+	if (this->wildcards) {
+		this->evaluate(value, 0, NULL, &result);
+		return result;
+	}
+
+	// without wildcards the path leads to one value at most
+	const JSValue* current = &value;
+
+	for (const Segment& s : this->segments) {
+		if (current->type == JSType::JSType_Object && current->object != NULL) {
+			current = current->object->findProperty(s.key.getBuffer(), s.key.length(), s.hash);
+			if (current == NULL) return result;
+		}
+		else if (current->type == JSType::JSType_Array && current->array != NULL
+						 && s.index >= 0 && (size_t)s.index < current->array->size()) {
+			current = &(*current->array)[s.index];
+		}
+		else {
+			return result;
+		}
+	}
+
+	return *current;
+}
+
+JSValue JSONPath::evaluate(const JSObject& object) const {
+	return this->evaluate(JSValue(const_cast<JSObject*>(&object)));
+}
+
+bool JSONPath::evaluateAll(const JSValue& value, std::vector<JSValue>& results) const {
+	const size_t count = results.size();
+
+	if (this->valid) {
+		this->evaluate(value, 0, &results, NULL);
+	}
+
+	return results.size() > count;
+}
+
+bool JSONPath::evaluateAll(const JSObject& object, std::vector<JSValue>& results) const {
+	return this->evaluateAll(JSValue(const_cast<JSObject*>(&object)), results);
+}
+
+////////////////// JSONPathExtractor //////////////////
+
+JSONPathExtractor::~JSONPathExtractor() {
+	this->reset();
+}
+
+bool JSONPathExtractor::addPath(const JSONPath& path) {
+	if (this->paths.size() >= 64) {
+		return false;
+	}
+
+	this->paths.push_back(&path);
+	return true;
+}
+
+void JSONPathExtractor::reset() {
+	for (Capture* capture : this->captures) {
+		freeValue(capture->root);
+		delete capture;
+	}
+
+	this->captures.clear();
+	this->frames.clear();
+}
+
+JSValue JSONPathExtractor::copyValue(const JSValue& value) {
+	JSValue copy = value;
+
+	if (value.type == JSType::JSType_String || value.type == JSType::JSType_Identifier) {
+		copy.str = new string(*value.str);
+	}
+
+	return copy;
+}
+
+void JSONPathExtractor::freeValue(JSValue& value) {
+	switch (value.type) {
+		case JSType::JSType_String:
+		case JSType::JSType_Identifier:
+			delete value.str;
+			break;
+
+		case JSType::JSType_Object:
+			delete value.object;
+			break;
+
+		case JSType::JSType_Array:
+			for (JSValue& e : *value.array) freeValue(e);
+			delete value.array;
+			break;
+
+		default:
+			break;
+	}
+
+	value.type = JSType::JSType_Unknown;
+}
+
+uint64_t JSONPathExtractor::matchIndex(const uint64_t candidates, const uint segment, const uint index) const {
+	uint64_t result = 0;
+	if (candidates == 0) return 0;
+
+	for (size_t p = 0; p < this->paths.size(); p++) {
+		if ((candidates & (1ULL << p)) != 0 && this->paths[p]->segments.size() > segment
+				&& this->paths[p]->matches(segment, index)) {
+			result |= 1ULL << p;
+		}
+	}
+
+	return result;
+}
+
+uint64_t JSONPathExtractor::matchKey(const uint64_t candidates, const uint segment, const char* key, const uint length) const {
+	uint64_t result = 0;
+	if (candidates == 0) return 0;
+
+	for (size_t p = 0; p < this->paths.size(); p++) {
+		if ((candidates & (1ULL << p)) != 0 && this->paths[p]->segments.size() > segment
+				&& this->paths[p]->matches(segment, key, length)) {
+			result |= 1ULL << p;
+		}
+	}
+
+	return result;
+}
+
+uint64_t JSONPathExtractor::beginValue(uint64_t& matched, uint& depth) {
+	uint64_t candidates;
+
+	if (this->frames.empty()) {
+		depth = 0;
+		candidates = this->paths.size() < 64 ? (1ULL << this->paths.size()) - 1 : ~0ULL;
+	} else {
+		Frame& frame = this->frames.back();
+		depth = frame.depth + 1;
+		candidates = frame.array ? this->matchIndex(frame.paths, frame.depth, frame.nextIndex++) : frame.keyPaths;
+	}
+
+	matched = 0;
+
+	for (size_t p = 0; candidates != 0 && p < this->paths.size(); p++) {
+		if ((candidates & (1ULL << p)) != 0 && this->paths[p]->segments.size() == depth) {
+			matched |= 1ULL << p;
+		}
+	}
+
+	return candidates;
+}
+
+void JSONPathExtractor::attach(Capture* capture, const JSValue& value) {
+	JSValue& parent = capture->containers.back();
+
+	if (parent.type == JSType::JSType_Array) {
+		parent.array->push_back(value);
+	} else {
+		parent.object->setProperty(capture->key, value);
+	}
+}
+
+bool JSONPathExtractor::beginScalar(uint64_t& matched) {
+	uint depth;
+	this->beginValue(matched, depth);
+
+	// values outside the paths are not copied
+	return matched != 0 || !this->captures.empty();
+}
+
+bool JSONPathExtractor::addScalar(const JSValue& value, uint64_t matched) {
+	for (Capture* capture : this->captures) {
+		this->attach(capture, copyValue(value));
+	}
+
+	for (size_t p = 0; matched != 0; p++) {
+		if ((matched & (1ULL << p)) != 0) {
+			matched &= ~(1ULL << p);
+
+			JSValue copy = copyValue(value);
+			if (!this->onMatch(p, copy)) return false;
+		}
+	}
+
+	return true;
+}
+
+bool JSONPathExtractor::beginContainer(const bool array) {
+	uint64_t matched;
+	Frame frame;
+	frame.array = array;
+	frame.paths = this->beginValue(matched, frame.depth);
+
+	for (Capture* capture : this->captures) {
+		const JSValue container = array ? JSValue(new std::vector<JSValue>()) : JSValue(new JSObject());
+		this->attach(capture, container);
+		capture->containers.push_back(container);
+	}
+
+	for (size_t p = 0; p < this->paths.size(); p++) {
+		if ((matched & (1ULL << p)) != 0) {
+			Capture* capture = new Capture();
+			capture->path = p;
+			capture->root = array ? JSValue(new std::vector<JSValue>()) : JSValue(new JSObject());
+			capture->containers.push_back(capture->root);
+			this->captures.push_back(capture);
+		}
+	}
+
+	this->frames.push_back(frame);
+	return true;
+}
+
+bool JSONPathExtractor::endContainer() {
+	if (this->frames.empty()) {
+		return false;
+	}
+
+	this->frames.pop_back();
+
+	for (Capture* capture : this->captures) {
+		capture->containers.pop_back();
+	}
+
+	// the captures of this container are the last ones, report them in order of path
+	size_t first = this->captures.size();
+	while (first > 0 && this->captures[first - 1]->containers.empty()) first--;
+
+	bool proceed = true;
+
+	for (size_t i = first; i < this->captures.size(); i++) {
+		Capture* capture = this->captures[i];
+
+		if (proceed) {
+			proceed = this->onMatch(capture->path, capture->root);
+		} else {
+			freeValue(capture->root);
+		}
+
+		delete capture;
+	}
+
+	this->captures.resize(first);
+	return proceed;
+}
+
+bool JSONPathExtractor::onObjectBegin() {
+	return this->beginContainer(false);
+}
+
+bool JSONPathExtractor::onObjectEnd() {
+	return this->endContainer();
+}
+
+bool JSONPathExtractor::onArrayBegin() {
+	return this->beginContainer(true);
+}
+
+bool JSONPathExtractor::onArrayEnd() {
+	return this->endContainer();
+}
+
+bool JSONPathExtractor::onKey(const char* key, const int length) {
+	if (this->frames.empty()) {
+		return false;
+	}
+
+	Frame& frame = this->frames.back();
+	frame.keyPaths = frame.paths != 0 ? this->matchKey(frame.paths, frame.depth, key, (uint)length) : 0;
+
+	for (Capture* capture : this->captures) {
+		capture->key.clear();
+		capture->key.append(key, length);
+	}
+
+	return true;
+}
+
+bool JSONPathExtractor::onString(const char* str, const int length) {
+	uint64_t matched;
+	if (!this->beginScalar(matched)) return true;
+
+	string text(str, length);
+
+	JSValue value(JSType::JSType_String);
+	value.str = &text;
+	return this->addScalar(value, matched);
+}
+
+bool JSONPathExtractor::onNumber(const double value) {
+	uint64_t matched;
+	return !this->beginScalar(matched) || this->addScalar(JSValue(value), matched);
+}
+
+bool JSONPathExtractor::onBoolean(const bool value) {
+	uint64_t matched;
+	return !this->beginScalar(matched) || this->addScalar(JSValue(value), matched);
+}
+
+bool JSONPathExtractor::onIdentifier(const char* name, const int length) {
+	uint64_t matched;
+	if (!this->beginScalar(matched)) return true;
+
+	string text(name, length);
+
+	JSValue value(JSType::JSType_Identifier);
+	value.str = &text;
+	return this->addScalar(value, matched);
+}
+
+}
@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef jsonpath_h
+#define jsonpath_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "string.h"
+#include "jstypes.h"
+#include "jsonreader.h"
+
+namespace ucm {
+
+class JSONPathExtractor;
+
+// A path to values in a document, parsed once and evaluated any number of times. Accepts
+// JSON Pointers such as /a/b/3/c and simple JSONPaths such as $.a.b[3].c, a.b[3].c or
+// $['a'][*].c, where * matches every property or element.
+class JSONPath
+{
+	friend JSONPathExtractor;
+
+private:
+	struct Segment {
+		string key;
+		uint hash = 0;
+
+		// element index, -1 when key is not a number
+		int index = -1;
+		bool wildcard = false;
+	};
+
+	std::vector<Segment> segments;
+	bool valid = false;
+	bool wildcards = false;
+
+	void addSegment(const char* key, const uint length, const bool wildcard = false);
+	bool compilePointer(const char* path);
+	bool compilePath(const char* path);
+
+	bool matches(const size_t segment, const char* key, const uint length) const;
+	bool matches(const size_t segment, const uint index) const;
+
+	// true once first is found, results receives every match instead when not NULL
+	bool evaluate(const JSValue& value, const size_t segment, std::vector<JSValue>* results, JSValue* first) const;
+
+public:
+	JSONPath() { }
+	JSONPath(const char* path);
+
+	// false and an invalid path when path cannot be parsed
+	bool compile(const char* path);
+
+	inline bool isValid() const {
+		return this->valid;
+	}
+
+	inline size_t getSegmentCount() const {
+		return this->segments.size();
+	}
+
+	// the first value the path matches in value, a JSType_Unknown value when there is none;
+	// values stay owned by the document like those getProperty returns
+	JSValue evaluate(const JSValue& value) const;
+	JSValue evaluate(const JSObject& object) const;
+
+	// append every value the path matches, false when there is none
+	bool evaluateAll(const JSValue& value, std::vector<JSValue>& results) const;
+	bool evaluateAll(const JSObject& object, std::vector<JSValue>& results) const;
+};
+
+// Handler for JSONReader::parse that builds only the values at the paths added, as
+// readValue would read them, and ignores the rest of the document. Up to 64 paths.
+// Matches are reported while parsing, so a key repeated in an object matches at every
+// occurrence in document order, where evaluate on a value read by readValue only sees
+// the last one.
+class JSONPathExtractor : public JSONHandler
+{
+private:
+	struct Frame {
+		bool array = false;
+		uint depth = 0;
+
+		// paths matching this container, and those matching the value of the last key
+		uint64_t paths = 0;
+		uint64_t keyPaths = 0;
+		uint nextIndex = 0;
+	};
+
+	// a matched object or array being built
+	struct Capture {
+		size_t path = 0;
+		JSValue root;
+		std::vector<JSValue> containers;
+		string key;
+	};
+
+	std::vector<const JSONPath*> paths;
+	std::vector<Frame> frames;
+	std::vector<Capture*> captures;
+
+	uint64_t matchIndex(const uint64_t candidates, const uint segment, const uint index) const;
+	uint64_t matchKey(const uint64_t candidates, const uint segment, const char* key, const uint length) const;
+
+	// paths matching the value starting now, matched receives those ending at it
+	uint64_t beginValue(uint64_t& matched, uint& depth);
+
+	void attach(Capture* capture, const JSValue& value);
+
+	// false when the value starting now is neither matched nor inside a matched value
+	bool beginScalar(uint64_t& matched);
+	bool addScalar(const JSValue& value, uint64_t matched);
+	bool beginContainer(const bool array);
+	bool endContainer();
+
+	static JSValue copyValue(const JSValue& value);
+	static void freeValue(JSValue& value);
+
+public:
+	virtual ~JSONPathExtractor();
+
+	// path must stay alive while parsing, false when 64 paths are added already
+	bool addPath(const JSONPath& path);
+
+	// forget the position of the last document, to parse another
+	void reset();
+
+	// value matched by the path numbered by the order it was added in; takes the
+	// ownership of value, return false to stop parsing
+	virtual bool onMatch(const size_t path, JSValue& value) = 0;
+
+	bool onObjectBegin();
+	bool onObjectEnd();
+	bool onArrayBegin();
+	bool onArrayEnd();
+
+	bool onKey(const char* key, const int length);
+	bool onString(const char* str, const int length);
+	bool onNumber(const double value);
+	bool onBoolean(const bool value);
+	bool onIdentifier(const char* name, const int length);
+};
+
+}
+
+#endif /* jsonpath_h */
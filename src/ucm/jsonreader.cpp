@@ -6,6 +6,23 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "jsonreader.h"
+#include "jsoncompact.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// SSE2 is part of every x86-64 target, no runtime check is needed like for AVX2
+#if defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <intrin.h>
+#include <emmintrin.h>
+#define JSONREADER_SSE2
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__)
+#include <emmintrin.h>
+#define JSONREADER_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define JSONREADER_NEON
+#endif
 
 #define COLON ':'
 #define COMMA ','
@@ -21,6 +38,40 @@ static inline int hexDigit(char h) {
 	return -1;
 }
 
+// position of the first backslash in s, n when there is none; quotes never appear
+// unescaped between the quotes of a string token
+static inline int findBackslash(const char* s, const int n) {
+	int i = 0;
+	
+#if defined(JSONREADER_SSE2)
+	const __m128i backslash = _mm_set1_epi8('\\');
+	
+	for (; i + 16 <= n; i += 16) {
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), backslash));
+		
+		if (mask != 0) {
+#if defined(_MSC_VER)
+			unsigned long bit;
+			_BitScanForward(&bit, (unsigned long)mask);
+			return i + (int)bit;
+#else
+			return i + __builtin_ctz(mask);
+#endif /* _MSC_VER */
+		}
+	}
+#elif defined(JSONREADER_NEON)
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	
+	// the block with a backslash is left to the loop below
+	for (; i + 16 <= n; i += 16) {
+		if (vmaxvq_u8(vceqq_u8(vld1q_u8((const uint8_t*)(s + i)), backslash)) != 0) break;
+	}
+#endif /* JSONREADER_SSE2 */
+	
+	while (i < n && s[i] != '\\') i++;
+	return i;
+}
+
 static void appendUTF8(string& out, unsigned int cp) {
 	if (cp < 0x80) {
 		out.append((char)cp);
@@ -40,13 +91,15 @@ static void appendUTF8(string& out, unsigned int cp) {
 }
 
 void JSONReader::unescapeJSONString(const string& raw, string& out) {
-	out.clear();
-	const char* s = raw.getBuffer();
-	const int n = raw.length();
-	for (int i = 0; i < n; i++) {
-		if (s[i] != '\\' || i + 1 >= n) {
+	unescapeJSONString(raw.getBuffer(), raw.length(), out);
+}
+
+// escape sequences following the backslash at s[i], the text before it is in out already
+static void unescapeFrom(const char* s, const int n, int i, string& out) {
+	while (i < n) {
+		if (i + 1 >= n) {
 			out.append(s[i]);
-			continue;
+			break;
 		}
 		char esc = s[++i];
 		switch (esc) {
@@ -91,15 +144,57 @@ void JSONReader::unescapeJSONString(const string& raw, string& out) {
 				out.append(esc);
 				break;
 		}
+		
+		// copy the run up to the next backslash at once
+		const int run = ++i;
+		i += findBackslash(s + run, n - run);
+		out.append(s + run, i - run);
 	}
 }
 
+void JSONReader::unescapeJSONString(const char* s, const int n, string& out) {
+	out.clear();
+	
+	const int i = findBackslash(s, n);
+	out.append(s, i);
+	unescapeFrom(s, n, i, out);
+}
+
+const char* JSONReader::viewJSONString(const char* s, const int n, string& buffer, int& length) {
+	const int i = findBackslash(s, n);
+	
+	if (i == n) {
+		length = n;
+		return s;
+	}
+	
+	buffer.clear();
+	buffer.append(s, i);
+	unescapeFrom(s, n, i, buffer);
+	
+	length = buffer.length();
+	return buffer.getBuffer();
+}
+
 JSONReader::JSONReader(const string& str) {
 	this->init(str);
 }
 
+JSONReader::JSONReader(Stream& stream, const size_t windowSize) {
+	this->init(stream, windowSize);
+}
+
 void JSONReader::init(const string& str) {
 	this->lexer.setInput(str);
+	this->indexBuilt = false;
+	this->streamInput = false;
+}
+
+void JSONReader::init(Stream& stream, const size_t windowSize) {
+	this->lexer.setInput(stream, windowSize);
+	this->indexBuilt = true;
+	this->indexUsable = false;
+	this->streamInput = true;
 }
 
 JSObject* JSONReader::readObject() {
@@ -137,13 +232,45 @@ JSObject* JSONReader::readObject() {
   return object;
 }
 
+JSObject* JSONReader::readLazyObject() {
+	if (this->streamInput) {
+		return this->readObject();
+	}
+	
+	JSONDocument* document = new JSONDocument(this->lexer.getInput());
+	const string& input = document->input;
+	
+	if (!document->index.build(input.getBuffer(), input.length())) {
+		document->release();
+		return this->readObject();
+	}
+	
+	document->index.trim();
+	
+	JSObject* object = NULL;
+	
+	if (document->index.getCount() > 0 && input.getBuffer()[document->index.getPositions()[0]] == LCBRACKET
+			&& document->validate()) {
+		object = document->readValue(0).object;
+	}
+	
+	document->release();
+	return object;
+}
+
+bool JSONReader::readCompact(JSONCompactDocument& document) {
+	JSONCompactBuilder builder(document);
+	return this->parse(builder) && builder.finish();
+}
+
 const bool JSONReader::readKey(string* key) {
 	if (this->lexer.readIdentifier()) {
 		*key = this->lexer.getTokenInputString();
 		return true;
 	}
 	if (this->lexer.readString()) {
-		unescapeJSONString(this->lexer.getTokenInputStringWithoutQuotations(), *key);
+		const Token& token = this->lexer.getCurrentToken();
+		unescapeJSONString(this->lexer.getTokenText() + 1, (int)token.length - 2, *key);
 		return true;
 	}
 	return false;
@@ -156,7 +283,7 @@ bool JSONReader::readValue(JSValue& value) {
   // string
   if (this->lexer.readString()) {
 		value.str = new string();
-		unescapeJSONString(lexer.getTokenInputStringWithoutQuotations(), *value.str);
+		unescapeJSONString(this->lexer.getTokenText() + 1, (int)this->lexer.getCurrentToken().length - 2, *value.str);
     value.type = JSType::JSType_String;
     return true;
   }
@@ -213,4 +340,624 @@ bool JSONReader::readArray(std::vector<JSValue>** list) {
   return this->lexer.readChar(']');
 }
 
-}
\ No newline at end of file
+bool JSONReader::parse(JSONHandler& handler) {
+	if (this->enableStructuralIndex) {
+		if (!this->indexBuilt) {
+			const string& input = this->lexer.getInput();
+			this->indexUsable = this->index.build(input.getBuffer(), input.length());
+			this->indexCursor = 0;
+			this->indexBuilt = true;
+		}
+		
+		if (this->indexUsable) {
+			return this->parseIndexedValue(handler);
+		}
+	}
+	
+	return this->parseValue(handler);
+}
+
+bool JSONReader::parseKey(JSONHandler& handler) {
+	if (this->lexer.readIdentifier()) {
+		const Token& token = this->lexer.getCurrentToken();
+		return handler.onKey(this->lexer.getTokenText(), (int)token.length);
+	}
+	
+	if (this->lexer.readString()) {
+		const Token& token = this->lexer.getCurrentToken();
+		int length;
+		const char* key = viewJSONString(this->lexer.getTokenText() + 1, (int)token.length - 2, this->text, length);
+		return handler.onKey(key, length);
+	}
+	
+	return false;
+}
+
+bool JSONReader::parseValue(JSONHandler& handler) {
+	if (this->lexer.readString()) {
+		const Token& token = this->lexer.getCurrentToken();
+		int length;
+		const char* str = viewJSONString(this->lexer.getTokenText() + 1, (int)token.length - 2, this->text, length);
+		return handler.onString(str, length);
+	}
+	else if (this->lexer.readNumber()) {
+		return handler.onNumber(this->lexer.getCurrentToken().v_num);
+	}
+	else if (this->lexer.readBoolean()) {
+		return handler.onBoolean(this->lexer.getCurrentToken().v_bool);
+	}
+	else if (this->lexer.readIdentifier()) {
+		const Token& token = this->lexer.getCurrentToken();
+		return handler.onIdentifier(this->lexer.getTokenText(), (int)token.length);
+	}
+	else if (this->lexer.readChar(LCBRACKET)) {
+		return this->parseObject(handler);
+	}
+	else if (this->lexer.readChar('[')) {
+		return this->parseArray(handler);
+	}
+	
+	return false;
+}
+
+bool JSONReader::parseObject(JSONHandler& handler) {
+	if (!handler.onObjectBegin()) {
+		return false;
+	}
+	
+	while (true) {
+		// empty objects and a trailing comma are accepted like readObject does
+		if (this->lexer.readChar(RCBRACKET)) {
+			return handler.onObjectEnd();
+		}
+		
+		if (!this->parseKey(handler)
+				|| !this->lexer.readChar(COLON)
+				|| !this->parseValue(handler)) {
+			return false;
+		}
+		
+		if (this->lexer.readChar(RCBRACKET)) {
+			return handler.onObjectEnd();
+		}
+		
+		if (!this->lexer.readChar(COMMA)) {
+			return false;
+		}
+	}
+}
+
+bool JSONReader::parseArray(JSONHandler& handler) {
+	if (!handler.onArrayBegin()) {
+		return false;
+	}
+	
+	while (true) {
+		if (this->lexer.readChar(']')) {
+			return handler.onArrayEnd();
+		}
+		
+		if (!this->parseValue(handler)) {
+			return false;
+		}
+		
+		if (this->lexer.readChar(']')) {
+			return handler.onArrayEnd();
+		}
+		
+		if (!this->lexer.readChar(COMMA)) {
+			return false;
+		}
+	}
+}
+
+////////////////// Structural index //////////////////
+
+static inline bool isJSONWhitespace(const char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool isIdentifierChar(const char c, const bool first) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$'
+		|| (!first && c >= '0' && c <= '9');
+}
+
+static inline bool isNumberStart(const char c) {
+	return (c >= '0' && c <= '9') || c == '-' || c == '.';
+}
+
+static bool isIdentifier(const char* s, const size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (!isIdentifierChar(s[i], i == 0)) return false;
+	}
+	
+	return length > 0;
+}
+
+static const double exactPowersOf10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// a JSON number taking all length characters of s; small numbers are computed exactly
+// from their digits, others are left to strtod
+static bool parseJSONNumber(const char* s, const size_t length, double& value) {
+	const char* p = s;
+	const char* end = s + length;
+	
+	const bool negative = *p == '-';
+	if (negative) p++;
+	
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool anyDigit = false;
+	
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa > 0) digits++;
+		} else {
+			exponent++;
+		}
+		anyDigit = true;
+		p++;
+	}
+	
+	if (p < end && *p == '.') {
+		p++;
+		
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa > 0) digits++;
+				exponent--;
+			}
+			anyDigit = true;
+			p++;
+		}
+	}
+	
+	if (!anyDigit) {
+		return false;
+	}
+	
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		
+		bool negativeExponent = false;
+		if (p < end && (*p == '+' || *p == '-')) {
+			negativeExponent = *p == '-';
+			p++;
+		}
+		
+		if (p >= end || *p < '0' || *p > '9') {
+			return false;
+		}
+		
+		int e = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (e < 100000) e = e * 10 + (*p - '0');
+			p++;
+		}
+		
+		exponent += negativeExponent ? -e : e;
+	}
+	
+	if (p != end) {
+		return false;
+	}
+	
+	if (digits < 19 && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+		value = (double)mantissa;
+		value = exponent < 0 ? value / exactPowersOf10[-exponent] : value * exactPowersOf10[exponent];
+	} else {
+		// the text is validated, strtod stops at the delimiter following it
+		value = strtod(negative ? s + 1 : s, NULL);
+	}
+	
+	if (negative) value = -value;
+	
+	return true;
+}
+
+size_t JSONReader::getIndexedAtomLength(const uint start) const {
+	const string& input = this->lexer.getInput();
+	const char* json = input.getBuffer();
+	
+	// atoms end at whitespace or the next structural character
+	const size_t next = this->indexCursor < this->index.getCount()
+		? this->index.getPositions()[this->indexCursor] : input.length();
+	
+	size_t end = start;
+	while (end < next && !isJSONWhitespace(json[end])) end++;
+	
+	return end - start;
+}
+
+const char* JSONReader::parseIndexedString(const uint start, int& length) {
+	// the closing quote always follows in the index
+	const uint end = this->index.getPositions()[this->indexCursor++];
+	
+	return viewJSONString(this->lexer.getInput().getBuffer() + start + 1, (int)(end - start - 1), this->text, length);
+}
+
+bool JSONReader::parseIndexedAtom(const uint start, JSONHandler& handler) {
+	const char* atom = this->lexer.getInput().getBuffer() + start;
+	const size_t length = this->getIndexedAtomLength(start);
+	
+	if (length == 4 && strncmp(atom, "true", 4) == 0) {
+		return handler.onBoolean(true);
+	}
+	
+	if (length == 5 && strncmp(atom, "false", 5) == 0) {
+		return handler.onBoolean(false);
+	}
+	
+	if (isNumberStart(*atom)) {
+		double value;
+		return parseJSONNumber(atom, length, value) && handler.onNumber(value);
+	}
+	
+	return isIdentifier(atom, length) && handler.onIdentifier(atom, (int)length);
+}
+
+bool JSONReader::parseIndexedValue(JSONHandler& handler) {
+	if (this->indexCursor >= this->index.getCount()) {
+		return false;
+	}
+	
+	const uint start = this->index.getPositions()[this->indexCursor++];
+	
+	switch (this->lexer.getInput().getBuffer()[start]) {
+		case '"': {
+			int length;
+			const char* str = this->parseIndexedString(start, length);
+			return handler.onString(str, length);
+		}
+			
+		case LCBRACKET:
+			return this->parseIndexedObject(handler);
+			
+		case '[':
+			return this->parseIndexedArray(handler);
+			
+		case RCBRACKET:
+		case ']':
+		case COLON:
+		case COMMA:
+			return false;
+			
+		default:
+			return this->parseIndexedAtom(start, handler);
+	}
+}
+
+bool JSONReader::parseIndexedObject(JSONHandler& handler) {
+	if (!handler.onObjectBegin()) {
+		return false;
+	}
+	
+	const char* json = this->lexer.getInput().getBuffer();
+	const uint* positions = this->index.getPositions();
+	const size_t count = this->index.getCount();
+	
+	while (true) {
+		if (this->indexCursor >= count) {
+			return false;
+		}
+		
+		const uint start = positions[this->indexCursor++];
+		
+		// empty objects and a trailing comma are accepted like readObject does
+		if (json[start] == RCBRACKET) {
+			return handler.onObjectEnd();
+		}
+		
+		if (json[start] == '"') {
+			int length;
+			const char* key = this->parseIndexedString(start, length);
+			
+			if (!handler.onKey(key, length)) {
+				return false;
+			}
+		} else {
+			const size_t length = this->getIndexedAtomLength(start);
+			
+			if (!isIdentifier(json + start, length) || !handler.onKey(json + start, (int)length)) {
+				return false;
+			}
+		}
+		
+		if (this->indexCursor >= count || json[positions[this->indexCursor++]] != COLON
+				|| !this->parseIndexedValue(handler)
+				|| this->indexCursor >= count) {
+			return false;
+		}
+		
+		const char c = json[positions[this->indexCursor++]];
+		
+		if (c == RCBRACKET) {
+			return handler.onObjectEnd();
+		}
+		
+		if (c != COMMA) {
+			return false;
+		}
+	}
+}
+
+bool JSONReader::parseIndexedArray(JSONHandler& handler) {
+	if (!handler.onArrayBegin()) {
+		return false;
+	}
+	
+	const char* json = this->lexer.getInput().getBuffer();
+	const uint* positions = this->index.getPositions();
+	const size_t count = this->index.getCount();
+	
+	while (true) {
+		if (this->indexCursor >= count) {
+			return false;
+		}
+		
+		if (json[positions[this->indexCursor]] == ']') {
+			this->indexCursor++;
+			return handler.onArrayEnd();
+		}
+		
+		if (!this->parseIndexedValue(handler) || this->indexCursor >= count) {
+			return false;
+		}
+		
+		const char c = json[positions[this->indexCursor++]];
+		
+		if (c == ']') {
+			return handler.onArrayEnd();
+		}
+		
+		if (c != COMMA) {
+			return false;
+		}
+	}
+}
+
+////////////////// Lazy document //////////////////
+
+// a literal, number or identifier of length characters, value receives it when not NULL
+static bool readJSONAtom(const char* atom, const size_t length, JSValue* value) {
+	if (length == 4 && strncmp(atom, "true", 4) == 0) {
+		if (value != NULL) *value = JSValue(true);
+		return true;
+	}
+	
+	if (length == 5 && strncmp(atom, "false", 5) == 0) {
+		if (value != NULL) *value = JSValue(false);
+		return true;
+	}
+	
+	if (isNumberStart(*atom)) {
+		double number;
+		if (!parseJSONNumber(atom, length, number)) return false;
+		
+		if (value != NULL) *value = JSValue(number);
+		return true;
+	}
+	
+	if (!isIdentifier(atom, length)) {
+		return false;
+	}
+	
+	if (value != NULL) {
+		value->type = JSType::JSType_Identifier;
+		value->str = new string();
+		value->str->append(atom, (int)length);
+	}
+	
+	return true;
+}
+
+JSONDocument::JSONDocument(const string& input) : input(input) {
+}
+
+void JSONDocument::release() {
+	if (--this->references == 0) {
+		delete this;
+	}
+}
+
+size_t JSONDocument::getAtomLength(const uint entry) const {
+	const char* json = this->input.getBuffer();
+	const uint start = this->index.getPositions()[entry];
+	const size_t next = entry + 1 < this->index.getCount()
+		? this->index.getPositions()[entry + 1] : this->input.length();
+	
+	size_t end = start;
+	while (end < next && !isJSONWhitespace(json[end])) end++;
+	
+	return end - start;
+}
+
+uint JSONDocument::getNextEntry(const uint entry) const {
+	switch (this->input.getBuffer()[this->index.getPositions()[entry]]) {
+		case LCBRACKET:
+		case '[':
+			return this->ends[entry] + 1;
+			
+		case '"':
+			return entry + 2;
+			
+		default:
+			return entry + 1;
+	}
+}
+
+bool JSONDocument::validate() {
+	enum State {
+		ExpectValue,
+		// first value of an array or a value after a comma, may end the array instead
+		ExpectValueOrEnd,
+		ExpectKey,
+		AfterValue,
+	};
+	
+	const char* json = this->input.getBuffer();
+	const uint* positions = this->index.getPositions();
+	const uint count = (uint)this->index.getCount();
+	
+	this->ends.assign(count, 0);
+	
+	// entries of the brackets not closed yet
+	std::vector<uint> open;
+	State state = ExpectValue;
+	uint entry = 0;
+	
+	while (entry < count) {
+		const uint e = entry++;
+		const char c = json[positions[e]];
+		
+		if (state == ExpectKey) {
+			// trailing commas are accepted like readObject does
+			if (c != RCBRACKET) {
+				if (c == '"') {
+					entry++;
+				} else if (!isIdentifier(json + positions[e], this->getAtomLength(e))) {
+					return false;
+				}
+				
+				if (entry >= count || json[positions[entry++]] != COLON) {
+					return false;
+				}
+				
+				state = ExpectValue;
+				continue;
+			}
+		}
+		else if (state == ExpectValue || state == ExpectValueOrEnd) {
+			if (c != ']' || state != ExpectValueOrEnd) {
+				if (c == LCBRACKET) {
+					open.push_back(e);
+					state = ExpectKey;
+					continue;
+				}
+				
+				if (c == '[') {
+					open.push_back(e);
+					state = ExpectValueOrEnd;
+					continue;
+				}
+				
+				if (c == '"') {
+					entry++;
+				} else if (!readJSONAtom(json + positions[e], this->getAtomLength(e), NULL)) {
+					return false;
+				}
+				
+				if (open.empty()) {
+					return true;
+				}
+				
+				state = AfterValue;
+				continue;
+			}
+		}
+		else {
+			const bool inObject = json[positions[open.back()]] == LCBRACKET;
+			
+			if (c == COMMA) {
+				state = inObject ? ExpectKey : ExpectValueOrEnd;
+				continue;
+			}
+			
+			if (c != (inObject ? RCBRACKET : ']')) {
+				return false;
+			}
+		}
+		
+		// c closes the innermost object or array
+		this->ends[open.back()] = e;
+		open.pop_back();
+		
+		if (open.empty()) {
+			return true;
+		}
+		
+		state = AfterValue;
+	}
+	
+	return false;
+}
+
+uint JSONDocument::readKeys(const uint entry, JSPropertyTable& properties) const {
+	const char* json = this->input.getBuffer();
+	const uint* positions = this->index.getPositions();
+	
+	uint keys = 0;
+	uint e = entry + 1;
+	string key;
+	
+	while (json[positions[e]] != RCBRACKET) {
+		if (json[positions[e]] == '"') {
+			JSONReader::unescapeJSONString(json + positions[e] + 1, (int)(positions[e + 1] - positions[e] - 1), key);
+			e += 2;
+		} else {
+			key.clear();
+			key.append(json + positions[e], (int)this->getAtomLength(e));
+			e++;
+		}
+		
+		// skip the colon, the last of duplicate keys is kept
+		JSValue& value = properties[key];
+		if (value.type != JSType::JSType_Deferred) keys++;
+		
+		value.type = JSType::JSType_Deferred;
+		value._entry = ++e;
+		
+		e = this->getNextEntry(e);
+		if (json[positions[e]] == COMMA) e++;
+	}
+	
+	return keys;
+}
+
+JSValue JSONDocument::readValue(const uint entry) {
+	const char* json = this->input.getBuffer();
+	const uint* positions = this->index.getPositions();
+	const char* text = json + positions[entry];
+	
+	switch (*text) {
+		case '"': {
+			JSValue value(JSType::JSType_String);
+			value.str = new string();
+			JSONReader::unescapeJSONString(text + 1, (int)(positions[entry + 1] - positions[entry] - 1), *value.str);
+			return value;
+		}
+			
+		case LCBRACKET:
+			return JSValue(new JSObject(this, entry));
+			
+		case '[': {
+			// empty arrays have no list like readArray gives
+			std::vector<JSValue>* list = NULL;
+			uint e = entry + 1;
+			
+			while (json[positions[e]] != ']') {
+				if (list == NULL) list = new std::vector<JSValue>();
+				list->push_back(this->readValue(e));
+				
+				e = this->getNextEntry(e);
+				if (json[positions[e]] == COMMA) e++;
+			}
+			
+			return JSValue(list);
+		}
+			
+		default: {
+			JSValue value;
+			readJSONAtom(text, this->getAtomLength(entry), &value);
+			return value;
+		}
+	}
+}
+
+}
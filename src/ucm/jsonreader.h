@@ -14,27 +14,137 @@
 #include "lexer.h"
 #include "string.h"
 #include "jstypes.h"
+#include "jsonindex.h"
 
 namespace ucm {
 
+// Receives the values of a document in order while JSONReader::parse runs, return false
+// from a callback to stop parsing. Strings and keys point into the input or into buffers
+// reused for the next value and are not null terminated, copy them to keep them.
+class JSONHandler
+{
+public:
+	virtual ~JSONHandler() { }
+	
+	virtual bool onObjectBegin() { return true; }
+	virtual bool onObjectEnd() { return true; }
+	virtual bool onArrayBegin() { return true; }
+	virtual bool onArrayEnd() { return true; }
+	
+	virtual bool onKey(const char*, const int) { return true; }
+	virtual bool onString(const char*, const int) { return true; }
+	virtual bool onNumber(const double) { return true; }
+	virtual bool onBoolean(const bool) { return true; }
+	
+	// unquoted names such as null
+	virtual bool onIdentifier(const char*, const int) { return true; }
+};
+
+class JSONReader;
+class JSONCompactDocument;
+
+// Input of lazily read objects, validated once and shared by all objects read from it.
+// Values are read from it when a JSObject first needs them.
+class JSONDocument
+{
+	friend JSONReader;
+	
+private:
+	string input;
+	JSONStructuralIndex index;
+	
+	// index entry of the closing bracket for the entries of opening brackets
+	std::vector<uint> ends;
+	uint references = 1;
+	
+	JSONDocument(const string& input);
+	~JSONDocument() { }
+	
+	bool validate();
+	size_t getAtomLength(const uint entry) const;
+	uint getNextEntry(const uint entry) const;
+	
+public:
+	void retain() { this->references++; }
+	void release();
+	
+	// read the keys of the object at entry into properties as deferred values,
+	// returns the number of keys
+	uint readKeys(const uint entry, JSPropertyTable& properties) const;
+	
+	JSValue readValue(const uint entry);
+};
+
 class JSONReader
 {
+	friend JSONDocument;
+	
 private:
 	Lexer lexer;
+	
+	// unescaped string or key handed to a JSONHandler, reused for every value
+	string text;
 
 	static void unescapeJSONString(const string& raw, string& out);
+	static void unescapeJSONString(const char* s, const int n, string& out);
+	
+	// the unescaped text of s: s itself when it has no escapes, otherwise buffer holding it
+	static const char* viewJSONString(const char* s, const int n, string& buffer, int& length);
+	
+	bool parseKey(JSONHandler& handler);
+	bool parseValue(JSONHandler& handler);
+	bool parseObject(JSONHandler& handler);
+	bool parseArray(JSONHandler& handler);
+	
+	// structural index of the input string and the next entry to read
+	JSONStructuralIndex index;
+	size_t indexCursor = 0;
+	bool indexBuilt = false;
+	bool indexUsable = false;
+	bool streamInput = false;
+	
+	bool parseIndexedValue(JSONHandler& handler);
+	bool parseIndexedObject(JSONHandler& handler);
+	bool parseIndexedArray(JSONHandler& handler);
+	const char* parseIndexedString(const uint start, int& length);
+	bool parseIndexedAtom(const uint start, JSONHandler& handler);
+	size_t getIndexedAtomLength(const uint start) const;
 
 public:
 	JSONReader() { }
 	JSONReader(const string& str);
+	JSONReader(Stream& stream, const size_t windowSize = Lexer::DefaultWindowSize);
 
   void init(const string& str);
+	
+	// read from stream as it is consumed, keeping only a window of the input in memory;
+	// the stream must stay open while reading
+	void init(Stream& stream, const size_t windowSize = Lexer::DefaultWindowSize);
 
   JSObject* readObject();
+	
+	// read a string input object only validating it, keys and values are read when they
+	// are accessed; input the structural index cannot read, such as comments, and stream
+	// input is read by readObject. Unlike readObject returns NULL if the input is malformed.
+	JSObject* readLazyObject();
+	
+	// read one value into document, replacing what it held; accepts the same input as
+	// readObject and uses the structural index when enabled
+	bool readCompact(JSONCompactDocument& document);
 
   const bool readKey(string* key);
   bool readValue(JSValue& value);
   bool readArray(std::vector<JSValue>** list);
+	
+	// read one value reporting it to handler instead of building objects, accepts the
+	// same input as readObject; false if the input is malformed or handler stopped
+	bool parse(JSONHandler& handler);
+	
+	// parse string input by locating all structural characters first (JSONStructuralIndex)
+	// and then walking them, instead of lexing character by character. Numbers are read as
+	// standard JSON numbers. Input with comments or single quoted strings, and stream
+	// input, is still parsed by the Lexer. readObject always uses the Lexer.
+	bool enableStructuralIndex = false;
 };
 
 }
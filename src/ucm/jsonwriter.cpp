@@ -5,6 +5,8 @@
 //  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+
 #include "jsonwriter.h"
 
 namespace ucm {
@@ -202,6 +204,16 @@ void JSONWriter::endArray() {
 	this->appendArrayEnd();
 }
 
+void JSONWriter::beginObjectElement() {
+	this->appendSeparatorComma();
+	this->beginObject();
+}
+
+void JSONWriter::beginArrayElement() {
+	this->appendSeparatorComma();
+	this->beginArray();
+}
+
 void JSONWriter::writeArrayElement(const string& value) {
 	this->appendSeparatorComma();
 	this->appendString(value);
@@ -226,6 +238,11 @@ void JSONWriter::writeArrayElementString(const string& str) {
 	this->writeString(str);
 }
 
+void JSONWriter::writeArrayElementBoolean(const bool value) {
+	this->appendSeparatorComma();
+	this->writeBoolean(value);
+}
+
 void JSONWriter::writeProperty(const char* key, const string& str) {
 	this->appendPropertyKey(key);
 	this->writeString(str);
@@ -376,8 +393,27 @@ void JSONWriter::writeArray(const std::vector<JSValue>& array) {
 void JSONWriter::writeObject(const JSObject& obj) {
 	this->beginObject();
 	
-	for (const auto& p : obj.getProperties()) {
-		this->writeProperty(p.first, p.second);
+	const JSPropertyTable& properties = obj.getProperties();
+	
+	if (this->format.sortKeys && properties.size() > 1) {
+		std::vector<const JSPropertyTable::Property*> sorted;
+		sorted.reserve(properties.size());
+		
+		for (const auto& p : properties) {
+			sorted.push_back(&p);
+		}
+		
+		std::sort(sorted.begin(), sorted.end(), [](const JSPropertyTable::Property* a, const JSPropertyTable::Property* b) {
+			return a->first < b->first;
+		});
+		
+		for (const auto* p : sorted) {
+			this->writeProperty(p->first, p->second);
+		}
+	} else {
+		for (const auto& p : properties) {
+			this->writeProperty(p.first, p.second);
+		}
 	}
 	
 	this->endObject();
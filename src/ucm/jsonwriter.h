@@ -32,6 +32,8 @@ struct JSONOutputFormat {
 	bool spaceAfterComma = true;
 	bool spaceBeforeColon = false;
 	bool spaceAfterColon = true;
+	// write object properties sorted by key, otherwise in the order they were read or set
+	bool sortKeys = true;
 
 	JSONOutputFormat();
 
@@ -106,6 +108,10 @@ public:
 	void beginArrayWithKey(const string& key);
 	void beginArray();
 	void endArray();
+	
+	// begin an object or array as the next element of the current array
+	void beginObjectElement();
+	void beginArrayElement();
 
 	void writeObject(const JSObject& obj);
 	
@@ -113,6 +119,7 @@ public:
 	void writeArrayElement(const char* format, ...);
 	void writeArrayElement(const double num);
 	void writeArrayElementString(const string& str);
+	void writeArrayElementBoolean(const bool value);
 	
 	void writeProperty(const char* key, const int num);
 	void writeProperty(const char* key, const double num);
@@ -5,10 +5,144 @@
 //  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
+
 #include "jstypes.h"
+#include "jsonreader.h"
 
 namespace ucm {
 
+////////////////// JSPropertyTable //////////////////
+
+uint JSPropertyTable::hashKey(const char* key, const uint length) {
+	// FNV-1a
+	uint hash = 2166136261U;
+	
+	for (uint i = 0; i < length; i++) {
+		hash ^= (byte)key[i];
+		hash *= 16777619U;
+	}
+	
+	return hash;
+}
+
+static inline bool keyEquals(const string& key, const char* str, const uint length) {
+	return (uint)key.length() == length && (length == 0 || memcmp(key.getBuffer(), str, length) == 0);
+}
+
+int JSPropertyTable::findIndex(const char* key, const uint length, const uint hash) const {
+	if (this->slots.empty()) {
+		for (size_t i = 0; i < this->hashes.size(); i++) {
+			if (this->hashes[i] == hash && keyEquals(this->properties[i].first, key, length)) {
+				return (int)i;
+			}
+		}
+		
+		return -1;
+	}
+	
+	const uint mask = (uint)this->slots.size() - 1;
+	
+	for (uint s = hash & mask; ; s = (s + 1) & mask) {
+		const uint slot = this->slots[s];
+		
+		if (slot == 0) {
+			return -1;
+		}
+		
+		if (this->hashes[slot - 1] == hash && keyEquals(this->properties[slot - 1].first, key, length)) {
+			return (int)slot - 1;
+		}
+	}
+}
+
+void JSPropertyTable::buildSlots(const size_t size) {
+	this->slots.assign(size, 0);
+	
+	const uint mask = (uint)size - 1;
+	
+	for (uint i = 0; i < (uint)this->hashes.size(); i++) {
+		uint s = this->hashes[i] & mask;
+		while (this->slots[s] != 0) s = (s + 1) & mask;
+		this->slots[s] = i + 1;
+	}
+}
+
+JSValue* JSPropertyTable::find(const char* key) {
+	const uint length = (uint)strlen(key);
+	const int index = this->findIndex(key, length, hashKey(key, length));
+	
+	return index >= 0 ? &this->properties[index].second : NULL;
+}
+
+const JSValue* JSPropertyTable::find(const char* key) const {
+	const uint length = (uint)strlen(key);
+	const int index = this->findIndex(key, length, hashKey(key, length));
+	
+	return index >= 0 ? &this->properties[index].second : NULL;
+}
+
+JSValue* JSPropertyTable::find(const char* key, const uint length, const uint hash) {
+	const int index = this->findIndex(key, length, hash);
+	return index >= 0 ? &this->properties[index].second : NULL;
+}
+
+JSValue& JSPropertyTable::operator[](const string& key) {
+	const char* str = key.getBuffer() != NULL ? key.getBuffer() : "";
+	const uint length = (uint)key.length();
+	const uint hash = hashKey(str, length);
+	
+	const int index = this->findIndex(str, length, hash);
+	
+	if (index >= 0) {
+		return this->properties[index].second;
+	}
+	
+	// most objects are small, skip the first steps of growing
+	if (this->properties.capacity() == 0) {
+		this->reserve(4);
+	}
+	
+	this->properties.push_back(Property(key, JSValue()));
+	this->hashes.push_back(hash);
+	
+	const size_t count = this->properties.size();
+	
+	if (count > LinearSearchLimit) {
+		// keep at least half of the slots free
+		if (count * 2 > this->slots.size()) {
+			size_t size = this->slots.empty() ? LinearSearchLimit * 4 : this->slots.size();
+			while (count * 2 > size) size *= 2;
+			this->buildSlots(size);
+		} else {
+			const uint mask = (uint)this->slots.size() - 1;
+			uint s = hash & mask;
+			while (this->slots[s] != 0) s = (s + 1) & mask;
+			this->slots[s] = (uint)count;
+		}
+	}
+	
+	return this->properties.back().second;
+}
+
+void JSPropertyTable::reserve(const size_t count) {
+	this->properties.reserve(count);
+	this->hashes.reserve(count);
+}
+
+void JSPropertyTable::clear() {
+	this->properties.clear();
+	this->hashes.clear();
+	this->slots.clear();
+}
+
+////////////////// JSObject //////////////////
+
+JSObject::JSObject(JSONDocument* document, const uint entry)
+: document(document), documentEntry(entry), propertiesLoaded(false) {
+	document->retain();
+}
+
 JSObject::~JSObject() {
 	for (auto& p : this->properties) {
 		if (p.second.type == JSType::JSType_String) {
@@ -32,14 +166,62 @@ JSObject::~JSObject() {
 	}
 	
 	this->properties.clear();
+	
+	if (this->document != NULL) {
+		this->document->release();
+		this->document = NULL;
+	}
+}
+
+void JSObject::loadProperties() const {
+	if (!this->propertiesLoaded) {
+		this->propertiesLoaded = true;
+		this->deferredCount = this->document->readKeys(this->documentEntry, this->properties);
+		
+		if (this->deferredCount == 0) {
+			this->document->release();
+			this->document = NULL;
+		}
+	}
+}
+
+void JSObject::loadValue(JSValue& value) const {
+	if (value.type == JSType::JSType_Deferred) {
+		value = this->document->readValue(value._entry);
+		this->releaseDeferredValue();
+	}
+}
+
+void JSObject::releaseDeferredValue() const {
+	// the document is not needed once every value is read
+	if (--this->deferredCount == 0) {
+		this->document->release();
+		this->document = NULL;
+	}
+}
+
+const JSPropertyTable& JSObject::getProperties() const {
+	this->loadProperties();
+	
+	if (this->document != NULL) {
+		for (auto& p : this->properties) {
+			this->loadValue(p.second);
+		}
+	}
+	
+	return this->properties;
 }
 
 void JSObject::setProperty(const string& key, JSValue value) {
-	this->properties[key] = value;
+	this->loadProperties();
+	
+	JSValue& property = this->properties[key];
+	if (property.type == JSType::JSType_Deferred) this->releaseDeferredValue();
+	property = value;
 }
 
 void JSObject::setProperty(const char* key, JSValue value) {
-  this->properties[key] = value;
+	this->setProperty(string(key), value);
 }
 
 void JSObject::setPropertyFormat(const string& key, const char* format, ...) {
@@ -67,36 +249,53 @@ void setProperty(const string& key, std::vector<T>& array) {
 }
 
 bool JSObject::hasProperty(const char* key, const JSType type) const {
-	const auto& it = this->properties.find(key);
+	this->loadProperties();
+	JSValue* value = this->properties.find(key);
 	
-	if (it == this->properties.end()) {
+	if (value == NULL) {
 		return false;
 	}
 	
-	if (type != JSType::JSType_Unknown && it->second.type != type)
+	this->loadValue(*value);
+	
+	if (type != JSType::JSType_Unknown && value->type != type)
 		return false;
 	
-	if (it->second.type == JSType::JSType_String && it->second.str == NULL)
+	if (value->type == JSType::JSType_String && value->str == NULL)
 		return false;
 	
-	if (it->second.type == JSType::JSType_Object && it->second.object == NULL)
+	if (value->type == JSType::JSType_Object && value->object == NULL)
 		return false;
 	
 	return true;
 }
 
 JSValue JSObject::getProperty(const char* key, const JSType requireType) const {
-  const auto& it = this->properties.find(key);
+	this->loadProperties();
+  JSValue* value = this->properties.find(key);
   
-  if (it != this->properties.end()) {
-    if (requireType == JSType_Unknown || it->second.type == requireType) {
-      return it->second;
+  if (value != NULL) {
+		this->loadValue(*value);
+
+    if (requireType == JSType_Unknown || value->type == requireType) {
+      return *value;
     }
   }
   
   return JSValue();
 }
 
+const JSValue* JSObject::findProperty(const char* key, const uint length, const uint hash) const {
+	this->loadProperties();
+	JSValue* value = this->properties.find(key, length, hash);
+	
+	if (value != NULL) {
+		this->loadValue(*value);
+	}
+	
+	return value;
+}
+
 double JSObject::getNumberProperty(const char* key, const double defValue) const {
 	const JSValue& val = this->getProperty(key, JSType::JSType_Number);
 	return (val.type == JSType::JSType_Number) ? val.number : defValue;
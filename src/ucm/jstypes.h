@@ -29,47 +29,13 @@ enum JSType
   JSType_Identifier,
   JSType_Object,
   JSType_Array,
+	// value of a lazily read object that is not read from its document yet, JSObject
+	// reads it before returning it
+	JSType_Deferred,
 };
 
-struct JSValue;
-
-class JSObject {
-private:
-  std::map<string, JSValue> properties;
-  
-public:
-	~JSObject();
-
-	inline int getPropertyCount() const {
-		return (int)this->properties.size();
-	}
-
-	void setProperty(const string& key, JSValue value);
-	void setProperty(const char* key, JSValue value);
-	void setPropertyFormat(const string& key, const char* format, ...);
-//	void setProperty(const string& key, JSObject* value);
-//	void setProperty(const char* key, const string& str);
-	template<typename T>
-	void setProperty(const string& key, std::vector<T>& array);
-//	void setProperty(const string& key, void* arr, uint length);
-
-	bool hasProperty(const char* key, const JSType type = JSType::JSType_Unknown) const;
-  JSValue getProperty(const char* key, const JSType requireType = JSType_Unknown) const;
-	
-	double getNumberProperty(const char* key, const double defValue = 0) const;
-	template<typename T>
-	bool tryGetNumberProperty(const char* key, T* value, const bool paraseFromString = false) const;
-	
-	string* getStringProperty(const char* key) const;
-	std::vector<JSValue>* getArrayProperty(const char* key) const;
-	JSObject* getObjectProperty(const char* key) const;
-	bool isBooleanPropertyTrue(const char* key) const;
-	bool isBooleanPropertyFalse(const char* key) const;
-
-  inline const std::map<string, JSValue>& getProperties() const {
-    return this->properties;
-  }
-};
+class JSObject;
+class JSONDocument;
 
 struct JSValue
 {
@@ -82,6 +48,7 @@ struct JSValue
     JSObject* object;
     std::vector<JSValue>* array;
     void* _data;
+		uint _entry;
   };
 	
 	JSValue(const JSType type = JSType::JSType_Unknown)
@@ -121,6 +88,123 @@ struct JSValue
 	}
 };
 
+// Properties of a JSObject in the order they are added. Keys and values are kept side by
+// side in one array with the hash of every key; small objects are searched by comparing
+// the hashes in turn, larger ones through an open addressing index into the array.
+class JSPropertyTable
+{
+public:
+	typedef std::pair<string, JSValue> Property;
+	typedef std::vector<Property>::iterator iterator;
+	typedef std::vector<Property>::const_iterator const_iterator;
+
+	// tables with more properties than this are indexed
+	static const uint LinearSearchLimit = 8;
+
+private:
+	std::vector<Property> properties;
+	std::vector<uint> hashes;
+	
+	// property index plus one per slot, 0 for free slots; empty while not indexed
+	std::vector<uint> slots;
+	
+	int findIndex(const char* key, const uint length, const uint hash) const;
+	void buildSlots(const size_t size);
+
+public:
+	static uint hashKey(const char* key, const uint length);
+
+	// value of key, NULL when there is no such property
+	JSValue* find(const char* key);
+	const JSValue* find(const char* key) const;
+	
+	// find with the length and hashKey of key computed beforehand
+	JSValue* find(const char* key, const uint length, const uint hash);
+
+	// value of key, a new JSType_Unknown value is added when there is no such property
+	JSValue& operator[](const string& key);
+
+	void reserve(const size_t count);
+	void clear();
+
+	inline size_t size() const { return this->properties.size(); }
+	inline bool empty() const { return this->properties.empty(); }
+
+	inline iterator begin() { return this->properties.begin(); }
+	inline iterator end() { return this->properties.end(); }
+	inline const_iterator begin() const { return this->properties.begin(); }
+	inline const_iterator end() const { return this->properties.end(); }
+};
+
+// Objects read by JSONReader::readLazyObject read their keys from the document on first
+// access and each value the first time it is requested, so even const members modify
+// them and a lazy object must not be read from several threads at once.
+class JSObject {
+	friend JSONDocument;
+	
+private:
+	mutable JSPropertyTable properties;
+	
+	mutable JSONDocument* document = NULL;
+	uint documentEntry = 0;
+	mutable uint deferredCount = 0;
+	mutable bool propertiesLoaded = true;
+	
+	JSObject(JSONDocument* document, const uint entry);
+	
+	void loadProperties() const;
+	void loadValue(JSValue& value) const;
+	void releaseDeferredValue() const;
+  
+public:
+	JSObject() { }
+	~JSObject();
+	
+	JSObject(const JSObject&) = delete;
+	JSObject& operator=(const JSObject&) = delete;
+	
+	// true while values are still to be read from the document
+	inline bool isLazy() const {
+		return this->document != NULL;
+	}
+
+	inline int getPropertyCount() const {
+		this->loadProperties();
+		return (int)this->properties.size();
+	}
+
+	void setProperty(const string& key, JSValue value);
+	void setProperty(const char* key, JSValue value);
+	void setPropertyFormat(const string& key, const char* format, ...);
+//	void setProperty(const string& key, JSObject* value);
+//	void setProperty(const char* key, const string& str);
+	template<typename T>
+	void setProperty(const string& key, std::vector<T>& array);
+//	void setProperty(const string& key, void* arr, uint length);
+
+	bool hasProperty(const char* key, const JSType type = JSType::JSType_Unknown) const;
+  JSValue getProperty(const char* key, const JSType requireType = JSType_Unknown) const;
+	
+	// value of key by the length and JSPropertyTable::hashKey of key, NULL when there is
+	// no such property; for lookups repeated with the same keys
+	const JSValue* findProperty(const char* key, const uint length, const uint hash) const;
+	
+	double getNumberProperty(const char* key, const double defValue = 0) const;
+	template<typename T>
+	bool tryGetNumberProperty(const char* key, T* value, const bool paraseFromString = false) const;
+	
+	string* getStringProperty(const char* key) const;
+	std::vector<JSValue>* getArrayProperty(const char* key) const;
+	JSObject* getObjectProperty(const char* key) const;
+	bool isBooleanPropertyTrue(const char* key) const;
+	bool isBooleanPropertyFalse(const char* key) const;
+
+	// properties in the order they were read or set, reads all remaining values of a
+	// lazy object
+	const JSPropertyTable& getProperties() const;
+};
+
+
 template<typename T>
 bool JSObject::tryGetNumberProperty(const char* key, T* value, const bool parseFromString) const {
 	const JSValue& val = this->getProperty(key, JSType::JSType_Number);
@@ -9,11 +9,12 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <memory>
 
-#define set_start     uint __start = pos
+#define set_start     size_t __start = pos; this->keepPosition = __start
 #define set_length    this->currentToken.start = __start; \
-											this->currentToken.length = this->stream.getPosition() - __start - 1
+											this->currentToken.length = this->pos - __start
 
 namespace ucm {
 
@@ -21,18 +22,98 @@ namespace ucm {
 		this->setInput(input);
 	}
 
+	Lexer::~Lexer() {
+		delete[] this->window;
+	}
+
 	void Lexer::setInput(const string& input) {
-		this->stream.setInput(input);
-		this->pos = -1;
+		this->input = input;
+		this->source = NULL;
+		this->buffer = this->input.getBuffer() != NULL ? this->input.getBuffer() : "";
+		this->bufferStart = 0;
+		this->bufferLength = this->input.length();
+		this->readIndex = 0;
+		this->keepPosition = 0;
+		this->pos = (size_t)-1;
+		
+		this->nextChar();
+	}
+
+	void Lexer::setInput(Stream& stream, const size_t windowSize) {
+		this->input.clear();
+		
+		if (this->window == NULL || this->windowSize != windowSize) {
+			delete[] this->window;
+			this->windowSize = windowSize < 16 ? 16 : windowSize;
+			this->window = new char[this->windowSize];
+		}
+		
+		this->minimumWindowSize = this->windowSize;
+		this->window[0] = STR_EOF;
+		this->source = &stream;
+		this->buffer = this->window;
+		this->bufferStart = 0;
+		this->bufferLength = 0;
+		this->readIndex = 0;
+		this->keepPosition = 0;
+		this->pos = (size_t)-1;
 		
 		this->nextChar();
 	}
 
+	char Lexer::fillBuffer() {
+		if (this->source == NULL) {
+			return STR_EOF;
+		}
+		
+		// drop the characters before the current token, it may continue in the new data
+		size_t drop = this->keepPosition > this->bufferStart ? this->keepPosition - this->bufferStart : 0;
+		if (drop > this->readIndex) drop = this->readIndex;
+		
+		const size_t kept = this->bufferLength - drop;
+		size_t size = this->windowSize;
+		
+		if (kept + 1 >= size) {
+			while (kept + 1 >= size) size *= 2;
+		} else if (size > this->minimumWindowSize && kept + 1 < this->minimumWindowSize) {
+			// a long token has been read, go back to the normal window size
+			size = this->minimumWindowSize;
+		}
+		
+		if (size != this->windowSize) {
+			char* newWindow = new char[size];
+			memcpy(newWindow, this->window + drop, kept);
+			delete[] this->window;
+			this->window = newWindow;
+			this->windowSize = size;
+		} else if (drop > 0 && kept > 0) {
+			memmove(this->window, this->window + drop, kept);
+		}
+		
+		this->buffer = this->window;
+		this->bufferStart += drop;
+		this->bufferLength = kept;
+		this->readIndex -= drop;
+		
+		const int read = this->source->read(this->window + kept, (uint)(this->windowSize - kept - 1));
+		
+		if (read <= 0) {
+			this->window[kept] = STR_EOF;
+			this->source = NULL;
+			return STR_EOF;
+		}
+		
+		this->bufferLength += read;
+		this->window[this->bufferLength] = STR_EOF;
+		
+		return this->window[this->readIndex++];
+	}
+
 	const string& Lexer::getInput() const {
-		return this->stream.getInput();
+		return this->input;
 	}
 
-	void Lexer::setToken(const TokenType type, const int start, const int length) {
+	void Lexer::setToken(const TokenType type, const size_t start, const size_t length) {
 		this->currentToken.type = type;
 		this->currentToken.start = start;
 		this->currentToken.length = length;
@@ -51,11 +132,14 @@ namespace ucm {
 	void Lexer::prepareTokenInputStrings() {
 		if (!this->tokenInputStringChanged) {
 			const Token& t = this->currentToken;
+			const char* text = this->getTokenText();
 			this->currentTokenInputString.clear();
-			this->currentTokenInputString.append(this->getInput() + t.start, t.length);
+			this->currentTokenInputString.append(text, (int)t.length);
 
 			this->currentTokenInputStringWithoutQuotations.clear();
-			this->currentTokenInputStringWithoutQuotations.append(this->getInput() + t.start + 1, t.length - 2);
+			if (t.length >= 2) {
+				this->currentTokenInputStringWithoutQuotations.append(text + 1, (int)t.length - 2);
+			}
 			this->tokenInputStringChanged = false;
 		}
 	}
@@ -77,6 +161,10 @@ namespace ucm {
 		bool inBlockComment = false;
 		
 		while (c != STR_EOF) {
+			if (inBlockComment || inLineComment) {
+				this->keepPosition = this->pos;
+			}
+			
 			if (inBlockComment) {
 				if (c == '*') {
 					nextChar();
@@ -113,6 +201,7 @@ namespace ucm {
 				case '\t':
 				case '\r':
 				case '\n':
+					this->keepPosition = this->pos;
 					nextChar();
 					continue;
 					
@@ -136,7 +225,7 @@ namespace ucm {
 		skipWS();
 		
 		bool first = true;
-		uint length = 0;
+		size_t length = 0;
 		set_start;
 		
 		while (true)
@@ -278,9 +367,9 @@ namespace ucm {
 				break;
 		}
 		
-		int length = this->pos - __start;
+		const size_t length = this->pos - __start;
 		
-		if (length <= 0) {
+		if (length == 0) {
 			return false;
 		}
 		
@@ -292,7 +381,7 @@ namespace ucm {
 		currentToken.type = TokenType::token_number;
 		currentToken.v_num = (negative ? -value : value);
 		currentToken.start = __start;
-		currentToken.length = (uint)length;
+		currentToken.length = length;
 		
 		return true;
 	}
@@ -320,7 +409,7 @@ namespace ucm {
 				nextChar();                // consume closing quote
 				currentToken.type = TokenType::token_string;
 				currentToken.start = __start;
-				currentToken.length = (uint)pos - __start;
+				currentToken.length = pos - __start;
 				return true;
 			}
 			nextChar();
@@ -354,10 +443,12 @@ namespace ucm {
 
 		bool success = false;
 		
-		if (strncmp(stream.getInput().getBuffer() + __start, "true", 4) == 0) {
+		const char* text = this->buffer + (__start - this->bufferStart);
+		
+		if (strncmp(text, "true", 4) == 0) {
 			currentToken.v_bool = true;
 			success = true;
-		} else if (strncmp(stream.getInput().getBuffer() + __start, "false", 5) == 0) {
+		} else if (strncmp(text, "false", 5) == 0) {
 			currentToken.v_bool = false;
 			success = true;
 		}
@@ -411,8 +502,9 @@ namespace ucm {
 		
 		this->skipWS();
 		
-		uint start = this->pos;
-		uint len = 0;
+		const size_t start = this->pos;
+		size_t len = 0;
+		this->keepPosition = start;
 
 		while (!eof()) {
 			if (!this->readAlphabetAndNumberChar()
@@ -11,7 +11,7 @@
 #include <stdio.h>
 
 #include "string.h"
-#include "stringstream.h"
+#include "stream.h"
 #include "types.h"
 
 namespace ucm {
@@ -51,8 +51,9 @@ namespace ucm {
 	struct Token {
 		TokenType type = TokenType::token_nil;
 		
-		uint start = 0;
-		uint length = 0;
+		// position in the input and length in bytes
+		size_t start = 0;
+		size_t length = 0;
 		
 		union
 		{
@@ -65,33 +66,61 @@ namespace ucm {
 	class Lexer 
 	{
 	private:
-		StringReader stream;
+		// characters are read from buffer, which holds the whole input string or a window
+		// of the input stream starting at position bufferStart; buffer[bufferLength] is zero
+		string input;
+		Stream* source = NULL;
+		char* window = NULL;
+		size_t windowSize = 0;
+		size_t minimumWindowSize = 0;
+		const char* buffer = "";
+		size_t bufferStart = 0;
+		size_t bufferLength = 0;
+		size_t readIndex = 0;
+		
+		// first position still needed when the window is refilled, the current token start
+		size_t keepPosition = 0;
+		
 		char c = STR_EOF;
-		int pos = -1;
+		size_t pos = (size_t)-1;
 		Token currentToken;
 		string currentTokenInputString;
 		string currentTokenInputStringWithoutQuotations;
 		bool tokenInputStringChanged = false;
 		
 		inline void nextChar() {
-			c = stream.readChar();
+			c = this->readIndex < this->bufferLength ? this->buffer[this->readIndex++] : this->fillBuffer();
 			pos++;
 		}
-
-		void setToken(const TokenType type, const int start, const int length);
+		
+		char fillBuffer();
+		void setToken(const TokenType type, const size_t start, const size_t length);
 		void prepareTokenInputStrings();
 		
 	public:
+		static constexpr size_t DefaultWindowSize = 64 * 1024;
+		
 		Lexer() { }
 		Lexer(const string& input);
+		~Lexer();
+		
+		Lexer(const Lexer&) = delete;
+		Lexer& operator=(const Lexer&) = delete;
 		
 		virtual void setInput(const string& input);
+		
+		// read the input from stream through a window of windowSize bytes, refilled as the
+		// input is consumed; the window grows only to hold a token longer than itself.
+		// The stream must stay open while reading.
+		virtual void setInput(Stream& stream, const size_t windowSize = DefaultWindowSize);
+		
+		// the input string, empty when reading from a stream
 		const string& getInput() const;
 
 		inline char getCurrentChar() const { return this->c; }
 
 		inline bool eof() const {
-			return this->c == STR_EOF || this->pos >= stream.getLength();
+			return this->c == STR_EOF || this->pos >= this->bufferStart + this->bufferLength;
 		}
 		
 		bool enableSkipWS = true;
@@ -111,6 +140,11 @@ namespace ucm {
 		bool readAlphabetNumberAndValidSymbols();
 		bool readAlphabetAndNumberChar();
 		
+		// characters of the current token, valid until the next read
+		inline const char* getTokenText() const {
+			return this->buffer + (this->currentToken.start - this->bufferStart);
+		}
+		
 		int getTokenInput(char* buffer) const;
 		const string& getTokenInputString();
 		const string& getTokenInputStringWithoutQuotations();
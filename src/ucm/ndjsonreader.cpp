@@ -0,0 +1,320 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ndjsonreader.h"
+#include "jsonreader.h"
+
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace ucm {
+
+struct NDJSONReader::Batch {
+	uint64_t sequence = 0;
+	uint64_t firstLine = 0;
+
+	// the lines, in buffer when read from a stream
+	const char* data = NULL;
+	size_t length = 0;
+	std::vector<char> buffer;
+
+	// parsed objects and their lines, NULL for lines that are not objects
+	std::vector<std::pair<uint64_t, JSObject*>> records;
+
+	~Batch() {
+		for (auto& record : this->records) {
+			delete record.second;
+		}
+	}
+};
+
+// cuts the input into batches of whole lines
+class NDJSONReader::Source {
+public:
+	virtual ~Source() { }
+	virtual bool readBatch(Batch& batch, const size_t batchSize) = 0;
+};
+
+class NDJSONReader::StreamSource : public NDJSONReader::Source {
+private:
+	Stream& stream;
+	bool end = false;
+
+	// the incomplete line at the end of the last batch
+	std::vector<char> carry;
+
+public:
+	StreamSource(Stream& stream) : stream(stream) { }
+
+	bool readBatch(Batch& batch, const size_t batchSize) {
+		std::vector<char>& buffer = batch.buffer;
+		buffer.swap(this->carry);
+		this->carry.clear();
+
+		// read until the batch is full and ends with a newline, lines longer than a batch
+		// are read whole
+		size_t lineEnd = 0;
+
+		while (!this->end && (lineEnd == 0 || buffer.size() < batchSize)) {
+			const size_t used = buffer.size();
+			buffer.resize(used + std::max(batchSize > used ? batchSize - used : 0, (size_t)65536));
+
+			const int read = this->stream.read(buffer.data() + used, (uint)(buffer.size() - used));
+			buffer.resize(used + (read > 0 ? read : 0));
+
+			if (read <= 0) {
+				this->end = true;
+				break;
+			}
+
+			for (size_t i = buffer.size(); i > used; i--) {
+				if (buffer[i - 1] == '\n') {
+					lineEnd = i;
+					break;
+				}
+			}
+		}
+
+		// the last line of the input needs no newline
+		if (!this->end) {
+			this->carry.assign(buffer.begin() + lineEnd, buffer.end());
+			buffer.resize(lineEnd);
+		}
+
+		batch.data = buffer.data();
+		batch.length = buffer.size();
+		return batch.length > 0;
+	}
+};
+
+class NDJSONReader::MemorySource : public NDJSONReader::Source {
+private:
+	const char* data;
+	size_t length;
+	size_t position = 0;
+
+public:
+	MemorySource(const char* data, const size_t length) : data(data), length(length) { }
+
+	bool readBatch(Batch& batch, const size_t batchSize) {
+		if (this->position >= this->length) {
+			return false;
+		}
+
+		size_t end = this->position + batchSize;
+
+		if (end >= this->length) {
+			end = this->length;
+		} else {
+			const char* newline = (const char*)memchr(this->data + end, '\n', this->length - end);
+			end = newline != NULL ? newline - this->data + 1 : this->length;
+		}
+
+		batch.data = this->data + this->position;
+		batch.length = end - this->position;
+		this->position = end;
+		return true;
+	}
+};
+
+NDJSONReader::NDJSONReader(const uint threadCount) {
+	this->threadCount = threadCount;
+
+	if (this->threadCount == 0) {
+		this->threadCount = std::thread::hardware_concurrency();
+		if (this->threadCount == 0) this->threadCount = 1;
+	}
+}
+
+void NDJSONReader::parseBatch(Batch& batch) {
+	JSONReader reader;
+	string text;
+
+	const char* p = batch.data;
+	const char* end = batch.data + batch.length;
+	uint64_t line = batch.firstLine;
+
+	while (p < end) {
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		const char* lineEnd = newline != NULL ? newline : end;
+
+		const char* q = p;
+		while (q < lineEnd && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+
+		// blank lines are skipped
+		if (q < lineEnd) {
+			text.clear();
+			text.append(q, (int)(lineEnd - q));
+			reader.init(text);
+
+			batch.records.push_back(std::make_pair(line, reader.readObject()));
+		}
+
+		p = lineEnd + 1;
+		line++;
+	}
+}
+
+bool NDJSONReader::read(Stream& stream, NDJSONHandler& handler, const bool ordered) {
+	StreamSource source(stream);
+	return this->read(source, handler, ordered);
+}
+
+bool NDJSONReader::read(const char* data, const size_t length, NDJSONHandler& handler, const bool ordered) {
+	MemorySource source(data, length);
+	return this->read(source, handler, ordered);
+}
+
+bool NDJSONReader::read(Source& source, NDJSONHandler& handler, const bool ordered) {
+	std::mutex lock;
+	std::condition_variable changed;
+
+	// batches waiting for a thread, and parsed batches by sequence
+	std::deque<Batch*> pending;
+	std::map<uint64_t, Batch*> parsed;
+	bool stopping = false;
+	std::exception_ptr error;
+
+	auto worker = [&]() {
+		std::unique_lock<std::mutex> guard(lock);
+
+		while (true) {
+			changed.wait(guard, [&]() { return stopping || !pending.empty(); });
+			if (stopping) break;
+
+			Batch* batch = pending.front();
+			pending.pop_front();
+
+			guard.unlock();
+
+			try {
+				parseBatch(*batch);
+			} catch (...) {
+				guard.lock();
+				if (!error) error = std::current_exception();
+				parsed[batch->sequence] = batch;
+				changed.notify_all();
+				continue;
+			}
+
+			guard.lock();
+			parsed[batch->sequence] = batch;
+			changed.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (uint i = 0; i < this->threadCount; i++) {
+		threads.push_back(std::thread(worker));
+	}
+
+	const size_t maxBatches = (size_t)this->threadCount * 2;
+	size_t batches = 0;
+	uint64_t nextSequence = 0;
+	uint64_t nextDelivery = 0;
+	uint64_t line = 0;
+	bool inputEnd = false;
+	bool completed = true;
+	Batch* batch = NULL;
+
+	try {
+		while (true) {
+			// keep every thread busy with a batch queued behind it
+			while (!inputEnd && batches < maxBatches) {
+				batch = new Batch();
+
+				if (!source.readBatch(*batch, this->batchSize)) {
+					delete batch;
+					batch = NULL;
+					inputEnd = true;
+					break;
+				}
+
+				batch->sequence = nextSequence++;
+				batch->firstLine = line;
+				line += std::count(batch->data, batch->data + batch->length, '\n');
+
+				std::lock_guard<std::mutex> guard(lock);
+				pending.push_back(batch);
+				batch = NULL;
+				batches++;
+				changed.notify_one();
+			}
+
+			if (batches == 0) {
+				break;
+			}
+
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				changed.wait(guard, [&]() {
+					return error || (ordered ? parsed.count(nextDelivery) > 0 : !parsed.empty());
+				});
+
+				if (error) break;
+
+				auto it = ordered ? parsed.find(nextDelivery) : parsed.begin();
+				batch = it->second;
+				parsed.erase(it);
+			}
+
+			batches--;
+			nextDelivery++;
+
+			for (auto& record : batch->records) {
+				JSObject* object = record.second;
+				record.second = NULL;
+
+				if (completed) {
+					completed = object != NULL ? handler.onRecord(record.first, object) : handler.onError(record.first);
+				} else {
+					delete object;
+				}
+			}
+
+			delete batch;
+			batch = NULL;
+
+			if (!completed) {
+				break;
+			}
+		}
+	} catch (...) {
+		delete batch;
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (!error) error = std::current_exception();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		changed.notify_all();
+	}
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	for (Batch* batch : pending) delete batch;
+	for (auto& it : parsed) delete it.second;
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	return completed;
+}
+
+}
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef ndjsonreader_h
+#define ndjsonreader_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "stream.h"
+#include "jstypes.h"
+
+namespace ucm {
+
+// Receives the records read by NDJSONReader, always on the thread that called read.
+class NDJSONHandler
+{
+public:
+	virtual ~NDJSONHandler() { }
+
+	// object read from the line numbered from 0, empty lines included; takes the
+	// ownership of object, return false to stop reading
+	virtual bool onRecord(const uint64_t line, JSObject* object) = 0;
+
+	// a line readObject cannot read an object from
+	virtual bool onError(const uint64_t) { return true; }
+};
+
+// Reads newline delimited JSON (JSON Lines) with one object per line. The input is cut into
+// batches of whole lines which a pool of threads parses, each thread with its own
+// JSONReader; at most two batches per thread are held in memory.
+class NDJSONReader
+{
+private:
+	struct Batch;
+	class Source;
+	class StreamSource;
+	class MemorySource;
+
+	uint threadCount;
+	size_t batchSize = 16 * 1024;
+
+	bool read(Source& source, NDJSONHandler& handler, const bool ordered);
+	static void parseBatch(Batch& batch);
+
+public:
+	// threadCount 0 uses one thread per hardware thread
+	NDJSONReader(const uint threadCount = 0);
+
+	// bytes of input per batch, lines longer than that make a batch of their own; small
+	// batches keep the objects in flight in cache
+	inline void setBatchSize(const size_t bytes) {
+		this->batchSize = bytes > 0 ? bytes : 1;
+	}
+
+	// read all lines of stream, records are delivered in input order when ordered is
+	// true and as soon as their batch is parsed otherwise; false if handler stopped
+	bool read(Stream& stream, NDJSONHandler& handler, const bool ordered = true);
+
+	// read lines from memory, such as a mapped file, without copying them
+	bool read(const char* data, const size_t length, NDJSONHandler& handler, const bool ordered = true);
+};
+
+}
+
+#endif /* ndjsonreader_h */
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "rwlock.h"
+
+namespace ucm {
+
+void ReadWriteLock::lockRead() {
+	std::unique_lock<std::mutex> guard(this->mutex);
+
+	if (this->writeDepth > 0 && this->writer == std::this_thread::get_id()) {
+		this->writeDepth++;
+		return;
+	}
+
+	this->released.wait(guard, [this] {
+		return this->writeDepth == 0 && this->waitingWriters == 0;
+	});
+
+	this->readers++;
+}
+
+void ReadWriteLock::unlockRead() {
+	std::lock_guard<std::mutex> guard(this->mutex);
+
+	if (this->writeDepth > 0 && this->writer == std::this_thread::get_id()) {
+		this->writeDepth--;
+		return;
+	}
+
+	if (--this->readers == 0) {
+		this->released.notify_all();
+	}
+}
+
+void ReadWriteLock::lockWrite() {
+	std::unique_lock<std::mutex> guard(this->mutex);
+
+	if (this->writeDepth > 0 && this->writer == std::this_thread::get_id()) {
+		this->writeDepth++;
+		return;
+	}
+
+	this->waitingWriters++;
+
+	this->released.wait(guard, [this] {
+		return this->writeDepth == 0 && this->readers == 0;
+	});
+
+	this->waitingWriters--;
+	this->writer = std::this_thread::get_id();
+	this->writeDepth = 1;
+}
+
+void ReadWriteLock::unlockWrite() {
+	std::lock_guard<std::mutex> guard(this->mutex);
+
+	if (--this->writeDepth == 0) {
+		this->writer = std::thread::id();
+		this->released.notify_all();
+	}
+}
+
+}
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef rwlock_h
+#define rwlock_h
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "types.h"
+
+namespace ucm {
+
+// Readers-writer lock, any number of readers or one writer. Waiting writers block new
+// readers so that a steady stream of reads cannot starve them, so a reader must not
+// lock again. The writer may lock again, for reading or writing, while it holds the lock.
+class ReadWriteLock {
+private:
+	std::mutex mutex;
+	std::condition_variable released;
+
+	uint readers = 0;
+	uint waitingWriters = 0;
+	uint writeDepth = 0;
+	std::thread::id writer;
+
+public:
+	void lockRead();
+	void unlockRead();
+	void lockWrite();
+	void unlockWrite();
+};
+
+class ReadLockGuard {
+private:
+	ReadWriteLock& lock;
+
+public:
+	ReadLockGuard(ReadWriteLock& lock) : lock(lock) {
+		this->lock.lockRead();
+	}
+
+	~ReadLockGuard() {
+		this->lock.unlockRead();
+	}
+};
+
+class WriteLockGuard {
+private:
+	ReadWriteLock& lock;
+
+public:
+	WriteLockGuard(ReadWriteLock& lock) : lock(lock) {
+		this->lock.lockWrite();
+	}
+
+	~WriteLockGuard() {
+		this->lock.unlockWrite();
+	}
+};
+
+}
+
+#endif /* rwlock_h */
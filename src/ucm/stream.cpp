@@ -27,7 +27,7 @@ MemoryStream::MemoryStream(const uint capacity) {
 	this->expand(capacity);
 }
 
-MemoryStream::MemoryStream(const byte* input, const uint length)
+MemoryStream::MemoryStream(const byte* input, const size_t length)
 : MemoryStream() {
 	if (length > 0) {
 		this->append(input, length);
@@ -55,7 +55,7 @@ protected:
 
 public:
 	MemoryStream(const uint capacity = MEMORY_STREAM_BUFFER_SIZE);
-	MemoryStream(const byte* input, const uint length);
+	MemoryStream(const byte* input, const size_t length);
 	~MemoryStream();
 	
 	inline const byte* getBuffer() const {
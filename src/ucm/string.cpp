@@ -90,6 +90,13 @@ string::string(const string& str) {
 	this->append(str);
 }
 
+string::string(string&& str) noexcept
+: buffer(str.buffer), len(str.len), capacity(str.capacity) {
+	// the source stays a usable empty string
+	str.initBuffer(0);
+	str.len = 0;
+}
+
 string::string(const char* str, const int len) {
 	this->initBuffer(len);
 	this->append(str, len);
@@ -112,7 +119,7 @@ void string::initBuffer(const int size) {
 
 void string::clear() {
 	this->len = 0;
-	this->buffer[0] = STR_EOF;
+	if (this->buffer != NULL) this->buffer[0] = STR_EOF;
 }
 
 void string::reset() {
@@ -366,6 +373,28 @@ void string::operator=(const string& str) {
 	this->append(str);
 }
 
+void string::operator=(string&& str) noexcept {
+	if (&str == this) return;
+	
+	char* previous = this->buffer;
+	const uint previousCapacity = this->capacity;
+	
+	this->buffer = str.buffer;
+	this->len = str.len;
+	this->capacity = str.capacity;
+	
+	// the source keeps the previous buffer as a usable empty string
+	if (previous != NULL) {
+		str.buffer = previous;
+		str.capacity = previousCapacity;
+		str.buffer[0] = STR_EOF;
+	} else {
+		str.initBuffer(0);
+	}
+	
+	str.len = 0;
+}
+
 string string::operator+(const char* str) {
 	string tmp = *this;
 	tmp.append(str);
@@ -62,6 +62,7 @@ public:
 	string(const char* str);
 	string(const char* str, const int len);
 	string(const string& str);
+	string(string&& str) noexcept;
   ~string();
 	
 	static const char empty[];
@@ -119,6 +120,7 @@ public:
 	
 	void operator=(const char* str);
 	void operator=(const string& str);
+	void operator=(string&& str) noexcept;
 	
 	string operator+(const char* str);
 
@@ -7,279 +7,1624 @@
 
 #include <memory>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 #include "trunk.h"
 #include "filestream.h"
 #include "deflate.h"
+#include "checksum.h"
 
-#define UID_GM_SEQUENTIALLY 1
-#define UID_GM_RANDOMLY 2
-#define UID_GENERATION_METHOD UID_GM_RANDOMLY
+#define JOURNAL_RECORD_MAGIC 0x4a4d4355
+#define DELTA_MAGIC 0x444d4355
+#define DELTA_VERSION 1
 
 namespace ucm {
 
+struct JournalRecord {
+	uint magic;
+	uint length;
+	uint64_t position;
+};
+
+struct DeltaHeader {
+	uint magic;
+	ushort ver;
+	ushort flags;
+	uint recordCount;
+	uint _reserved;
+};
+
+enum DeltaOperation {
+	DO_Add = 1,
+	DO_Remove = 2,
+	DO_Change = 3,
+};
+
+// followed by length stored bytes of the trunk for add and change, checksums are
+// the CRC-32C of the stored bytes
+struct DeltaRecord {
+	uint operation;
+	uint uid;
+	uint format;
+	ushort trunkFlags;
+	ushort userFlags;
+	uint checksum;
+	uint baseChecksum;
+	uint64_t length;
+};
+
+FileTrunk::FileTrunk() {
+	this->uidAllocator = new RandomUidAllocator();
+}
+
 FileTrunk::~FileTrunk() {
 	this->clear();
+	delete this->uidAllocator;
+}
+
+// FileStream reads and zlib streams take at most an int worth of bytes per call
+static constexpr size_t StreamBlockSize = 0x40000000;
+
+template<typename T>
+static void writeBlocks(T& stream, const byte* data, const size_t length) {
+	for (size_t offset = 0; offset < length; offset += StreamBlockSize) {
+		const size_t remaining = length - offset;
+		stream.write(data + offset, (uint)(remaining < StreamBlockSize ? remaining : StreamBlockSize));
+	}
+}
+
+static uint getElapsedMicroseconds(const std::chrono::steady_clock::time_point& start) {
+	return (uint)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+// new buffer holding the inflated stored bytes of a compressed trunk
+static byte* decompressData(const byte* data, const size_t length, size_t* outputLength) {
+	MemoryStream ms;
+	DecompressStream cs(ms);
+	writeBlocks(cs, data, length);
+	cs.flush();
+	
+	*outputLength = ms.getLength();
+	byte* buffer = new byte[*outputLength];
+	memcpy(buffer, ms.getBuffer(), *outputLength);
+	return buffer;
+}
+
+// copy length bytes at position of source into stream, missing source bytes are written
+// as zeros so that offsets already written stay valid
+static void copyStream(FileStream& source, const size_t position, const uint64_t length,
+											 Stream& stream, std::vector<byte>& buffer) {
+	if (buffer.empty()) {
+		buffer.resize(65536);
+	}
+	
+	source.setPosition(position);
+	
+	uint64_t remaining = length;
+	while (remaining > 0) {
+		const uint bytes = (uint)(remaining < buffer.size() ? remaining : buffer.size());
+		const int readBytes = source.read(buffer.data(), bytes);
+		if (readBytes <= 0) break;
+		stream.write(buffer.data(), readBytes);
+		remaining -= (uint)readBytes;
+	}
+	
+	if (remaining > 0) {
+		memset(buffer.data(), 0, buffer.size());
+		while (remaining > 0) {
+			const uint bytes = (uint)(remaining < buffer.size() ? remaining : buffer.size());
+			stream.write(buffer.data(), bytes);
+			remaining -= bytes;
+		}
+	}
 }
 
-bool FileTrunk::load(FileStream &stream) {
+static bool readStream(FileStream& stream, const size_t position, void* buffer, const size_t length) {
+	stream.setPosition(position);
+	
+	size_t total = 0;
+	while (total < length) {
+		const size_t remaining = length - total;
+		const uint bytes = (uint)(remaining < StreamBlockSize ? remaining : StreamBlockSize);
+		const int readBytes = stream.read((byte*)buffer + total, bytes);
+		if (readBytes <= 0) return false;
+		total += (size_t)readBytes;
+	}
+	
+	return true;
+}
+
+bool FileTrunk::load(FileStream &stream, const uint loadFlags) {
 	const size_t streamStartPos = stream.getPosition();
 	const size_t streamLength = stream.getLength();
 	if (streamLength < streamStartPos) return false;
 	const size_t available = streamLength - streamStartPos;
 
-	if (available < sizeof(TrunkHeader)) return false;
+	if (available < TrunkHeaderSizeV1) return false;
 
-	TrunkHeader header;
-	int readBytes = stream.read(&header, sizeof(TrunkHeader));
-	if ((size_t)readBytes < sizeof(TrunkHeader)) return false;
+	TrunkHeader header = { };
+	int readBytes = stream.read(&header, TrunkHeaderSizeV1);
+	if ((size_t)readBytes < TrunkHeaderSizeV1) return false;
 
-	if (header.headerSize < sizeof(TrunkHeader) || header.headerSize > available) return false;
+	if (header.headerSize < TrunkHeaderSizeV1 || header.headerSize > available) return false;
 
-	const size_t indicesBytes = (size_t)header.trunkCount * TrunkIndexSize;
-	if (indicesBytes > available - header.headerSize) return false;
+	const bool isV1 = header.ver < TrunkVersion2;
+	uint64_t indexOffset = header.headerSize;
+	
+	if (!isV1) {
+		if (header.headerSize < sizeof(TrunkHeader)) return false;
+		
+		readBytes = stream.read((byte*)&header + TrunkHeaderSizeV1, sizeof(TrunkHeader) - TrunkHeaderSizeV1);
+		if ((size_t)readBytes < sizeof(TrunkHeader) - TrunkHeaderSizeV1) return false;
+		
+		indexOffset = header.indexOffset;
+	}
 
-	stream.setPosition(streamStartPos + header.headerSize);
+	const size_t recordSize = isV1 ? TrunkIndexSizeV1 : TrunkIndexSize;
+	const uint64_t indicesBytes = (uint64_t)header.trunkCount * recordSize;
+	const bool hasDataLengths = !isV1 && (header.flags & TrunkHeaderDataLengths) != 0;
+	const uint64_t tableBytes = indicesBytes + (hasDataLengths ? (uint64_t)header.trunkCount * sizeof(uint64_t) : 0);
+	if (indexOffset > available || tableBytes > available - indexOffset) return false;
 
 	this->clear();
 
-	// read index
+	// read index table and data lengths at once and convert records
+	std::vector<byte> table((size_t)tableBytes);
+	if (!readStream(stream, streamStartPos + (size_t)indexOffset, table.data(), table.size())) {
+		return false;
+	}
+	
+	this->indices.resize(header.trunkCount);
+	
 	for (uint i = 0; i < header.trunkCount; i++) {
-		TrunkIndex index;
-		readBytes = stream.read(&index, TrunkIndexSize);
-		if ((size_t)readBytes < TrunkIndexSize) {
-			this->clear();
-			return false;
+		TrunkIndex& index = this->indices[i];
+		const byte* record = table.data() + (size_t)i * recordSize;
+		
+		if (isV1) {
+			TrunkIndexV1 v1;
+			memcpy(&v1, record, TrunkIndexSizeV1);
+			index.uid = v1.uid;
+			index.format = v1.format;
+			index.offset = v1.offset;
+			index.length = v1.length;
+			// version 1 has no checksums, the flag bit may hold anything
+			index.trunkFlags = v1.trunkFlags & ~FTF_Checksum;
+			index.userFlags = v1.userFlags;
+			index.checksum = 0;
+		} else {
+			TrunkIndexV2 v2;
+			memcpy(&v2, record, TrunkIndexSize);
+			index.uid = v2.uid;
+			index.format = v2.format;
+			index.offset = v2.offset;
+			index.length = v2.length;
+			index.trunkFlags = v2.trunkFlags;
+			index.userFlags = v2.userFlags;
+			index.checksum = v2.checksum;
+		}
+		
+		if (hasDataLengths) {
+			memcpy(&index.dataLength, table.data() + (size_t)indicesBytes + (size_t)i * sizeof(uint64_t), sizeof(uint64_t));
 		}
-		indices.push_back(index);
+		
+		this->uidAllocator->use(index.uid);
 	}
 
-	// read data
+	// read data, indices written by a deduplicating save share their data block
+	std::unordered_map<uint64_t, TrunkIndex*> loadedBlocks;
+	
 	for (TrunkIndex& index : this->indices) {
-		if ((size_t)index.offset > available
-			|| (size_t)index.length > available - (size_t)index.offset) {
+		if (index.offset > available
+			|| index.length > available - index.offset) {
 			this->clear();
 			return false;
 		}
 
-		stream.setPosition(streamStartPos + index.offset);
-		index.data = new byte[index.length];
-		byte* buffer = const_cast<byte*>(index.data);
-		readBytes = stream.read(buffer, index.length);
+		index.stored = true;
+
+		if (loadFlags & FTL_Lazy) {
+			index.source = &stream;
+			index.sourcePosition = streamStartPos + (size_t)index.offset;
+			continue;
+		}
 
-		if ((size_t)readBytes < (size_t)index.length) {
-			delete [] index.data;
-			index.data = NULL;
+		if (index.length == 0) continue;
+		
+		auto loaded = loadedBlocks.find(index.offset);
+		if (loaded != loadedBlocks.end()) {
+			TrunkIndex& block = *loaded->second;
+			
+			if (block.length == index.length && block.checksum == index.checksum
+					&& (block.trunkFlags & (FTF_Compress | FTF_Checksum)) == (index.trunkFlags & (FTF_Compress | FTF_Checksum))) {
+				this->shareTrunkData(index, block);
+				continue;
+			}
+		}
+		
+		byte* buffer = new byte[(size_t)index.length];
+		
+		if (readStream(stream, streamStartPos + (size_t)index.offset, buffer, (size_t)index.length)) {
+			index.data = buffer;
+		} else {
+			delete [] buffer;
 			index.length = 0;
+			continue;
+		}
+		
+		if (!this->isTrunkDataValid(index, buffer)) {
+			const uint uid = index.uid, format = index.format;
+			this->clear();
+			throw TrunkChecksumException(uid, format);
 		}
+		
+		loadedBlocks.insert(std::make_pair(index.offset, &index));
 	}
 
+	this->source = (loadFlags & FTL_Lazy) ? &stream : NULL;
+	this->fileStartPosition = streamStartPos;
+	this->fileLength = available;
+	this->fileVersion = isV1 ? TrunkVersion1 : TrunkVersion2;
+	this->fileFlags = hasDataLengths ? TrunkHeaderDataLengths : 0;
+	this->relinkIndices();
+
 	return true;
 }
 
 void FileTrunk::save(FileStream &stream) {
+	const size_t streamStartPos = stream.getPosition();
+	
 	TrunkHeader header = { };
-	header.ver = 0x0100;
-	header.flags = 0;
+	header.ver = TrunkVersion2;
+	header.flags = TrunkHeaderDataLengths;
 	header.trunkCount = (uint)this->indices.size();
 	header.headerSize = sizeof(TrunkHeader);
+	header.indexOffset = sizeof(TrunkHeader);
 	
 	stream.write(&header, sizeof(TrunkHeader));
 		
-	// write index
-	uint offset = (uint)(sizeof(TrunkHeader) + TrunkIndexSize * this->indices.size());
+	// write index, offsets are kept in the indices only after everything is written
+	// so that a failed save leaves this trunk bound to the previous file
+	std::vector<uint64_t> offsets;
+	offsets.reserve(this->indices.size());
 	
-	for (TrunkIndex& index : this->indices) {
-		index.offset = offset;
-		offset += index.length;
+	// shared data blocks are written once
+	std::map<BlockKey, uint64_t> blockOffsets;
+	std::vector<const TrunkIndex*> blocks;
+	
+	uint64_t offset = sizeof(TrunkHeader) + (uint64_t)(TrunkIndexSize + sizeof(uint64_t)) * this->indices.size();
+	
+	for (const TrunkIndex& index : this->indices) {
+		uint64_t recordOffset = offset;
 		
-		stream.write(&index, TrunkIndexSize);
+		if (index.length > 0) {
+			auto block = blockOffsets.insert(std::make_pair(getBlockKey(index), offset));
+			if (block.second) {
+				blocks.push_back(&index);
+				offset += index.length;
+			}
+			recordOffset = block.first->second;
+		}
+		
+		offsets.push_back(recordOffset);
+		writeIndexRecord(stream, index, recordOffset);
 	}
 	
+	this->writeDataLengths(stream);
+	
 	// write data
-	for (const TrunkIndex& index : this->indices) {
-		if (index.length > 0 && index.data != NULL) {
-			stream.write(index.data, index.length);
+	std::vector<byte> copyBuffer;
+	
+	for (const TrunkIndex* block : blocks) {
+		const TrunkIndex& index = *block;
+		
+		if (index.data != NULL) {
+			stream.write(index.data, (size_t)index.length);
+		} else if (index.source != NULL) {
+			// not loaded yet, copy straight from the source stream
+			copyStream(*index.source, index.sourcePosition, index.length, stream, copyBuffer);
 		}
 	}
+	
+	for (size_t i = 0; i < this->indices.size(); i++) {
+		this->indices[i].offset = offsets[i];
+		this->indices[i].stored = true;
+	}
+	
+	this->fileStartPosition = streamStartPos;
+	this->fileLength = (size_t)offset;
+	this->fileVersion = TrunkVersion2;
+	this->fileFlags = TrunkHeaderDataLengths;
+	
+	// spilled data is still read from the temporary files until attached to the saved file
 }
 
-void FileTrunk::clear() {
+bool FileTrunk::saveIncremental(FileStream &stream, FileStream* journal) {
+	if (!this->isFileBound() || this->fileVersion < TrunkVersion2) {
+		return false;
+	}
+	
+	const size_t endPos = stream.getLength();
+	if (endPos < this->fileStartPosition + this->fileLength) {
+		return false;
+	}
+	
+	uint64_t offset = endPos - this->fileStartPosition;
+	stream.setPosition(endPos);
+	
+	// append data of new and modified trunks, shared data blocks once
+	std::map<BlockKey, uint64_t> blockOffsets;
+	std::vector<byte> copyBuffer;
+	
 	for (TrunkIndex& index : this->indices) {
-		if (index.data != NULL) {
-			delete [] index.data;
+		if (index.stored) continue;
+		
+		if (index.length > 0 && (index.data != NULL || index.source != NULL)) {
+			auto block = blockOffsets.insert(std::make_pair(getBlockKey(index), offset));
+			if (block.second) {
+				if (index.data != NULL) {
+					stream.write(index.data, (size_t)index.length);
+				} else {
+					copyStream(*index.source, index.sourcePosition, index.length, stream, copyBuffer);
+				}
+				offset += index.length;
+			}
+			
+			index.offset = block.first->second;
+			
+			// written data can now be dropped and read back like a lazily loaded trunk
+			if (this->source != NULL) {
+				if (index.data != NULL && index.source == NULL) {
+					this->addResidentTrunk(index);
+				}
+				index.source = this->source;
+				index.sourcePosition = this->fileStartPosition + (size_t)index.offset;
+			}
+		} else {
+			this->removeContentKeys(index);
+			index.offset = 0;
+			index.length = 0;
 		}
+		
+		index.stored = true;
 	}
-	this->indices.clear();
+	
+	// append index table
+	const uint64_t indexOffset = offset;
+	
+	for (const TrunkIndex& index : this->indices) {
+		writeIndexRecord(stream, index, index.offset);
+		offset += TrunkIndexSize;
+	}
+	
+	this->writeDataLengths(stream);
+	offset += sizeof(uint64_t) * this->indices.size();
+	
+	// point the header to the new index table, the previous table stays valid until here
+	TrunkHeader header = { };
+	header.ver = TrunkVersion2;
+	header.flags = TrunkHeaderDataLengths;
+	header.trunkCount = (uint)this->indices.size();
+	header.headerSize = sizeof(TrunkHeader);
+	header.indexOffset = indexOffset;
+	
+	if (journal != NULL) {
+		stream.sync();
+		
+		JournalRecord record;
+		record.magic = JOURNAL_RECORD_MAGIC;
+		record.length = sizeof(TrunkHeader);
+		record.position = this->fileStartPosition;
+		
+		uLong crc = crc32(0L, Z_NULL, 0);
+		crc = crc32(crc, (const Bytef*)&record, sizeof(JournalRecord));
+		crc = crc32(crc, (const Bytef*)&header, sizeof(TrunkHeader));
+		const uint checksum = (uint)crc;
+		
+		journal->write(&record, sizeof(JournalRecord));
+		journal->write(&header, sizeof(TrunkHeader));
+		journal->write(&checksum, sizeof(checksum));
+		journal->sync();
+	} else {
+		stream.flush();
+	}
+	
+	stream.setPosition(this->fileStartPosition);
+	stream.write(&header, sizeof(TrunkHeader));
+	
+	if (journal != NULL) {
+		stream.sync();
+	} else {
+		stream.flush();
+	}
+	
+	this->fileLength = offset;
+	this->fileFlags = TrunkHeaderDataLengths;
+	this->evictTrunks(NULL);
+	this->releaseSpillStreams();
+	
+	return true;
 }
 
-FileTrunk::TrunkIndex* FileTrunk::getTrunkIndex(const uint uid, const uint format) {
-	for (TrunkIndex& index : this->indices) {
-		if (index.uid == uid) {
-			if (format == 0 || index.format == format) {
-				return &index;
-			}
-		}
+bool FileTrunk::applyJournal(FileStream& journal, FileStream& target) {
+	JournalRecord record;
+	if (journal.read(&record, sizeof(JournalRecord)) < (int)sizeof(JournalRecord)
+			|| record.magic != JOURNAL_RECORD_MAGIC || record.length > 4096) {
+		return false;
 	}
 	
-	return NULL;
+	std::vector<byte> data(record.length);
+	uint checksum = 0;
+	if (journal.read(data.data(), record.length) < (int)record.length
+			|| journal.read(&checksum, sizeof(checksum)) < (int)sizeof(checksum)) {
+		return false;
+	}
+	
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, (const Bytef*)&record, sizeof(JournalRecord));
+	crc = crc32(crc, (const Bytef*)data.data(), record.length);
+	if ((uint)crc != checksum) {
+		return false;
+	}
+	
+	target.setPosition((size_t)record.position);
+	target.write(data.data(), record.length);
+	target.sync();
+	
+	return true;
 }
 
-uint FileTrunk::getAvailableUid() {
-	int uid;
+void FileTrunk::writeIndexRecord(Stream& stream, const TrunkIndex& index, const uint64_t offset) {
+	TrunkIndexV2 record;
+	record.uid = index.uid;
+	record.format = index.format;
+	record.offset = offset;
+	record.length = index.length;
+	record.trunkFlags = index.trunkFlags;
+	record.userFlags = index.userFlags;
+	record.checksum = index.checksum;
+	
+	stream.write(&record, TrunkIndexSize);
+}
+
+void FileTrunk::writeDataLengths(Stream& stream) const {
+	std::vector<uint64_t> lengths;
+	lengths.reserve(this->indices.size());
 	
-#if UID_GENERATION_METHOD == UID_GM_SEQUENTIALLY
-	uid = (int)this->indices.size() + 1;
+	for (const TrunkIndex& index : this->indices) {
+		lengths.push_back(index.dataLength);
+	}
 	
-	bool found;
-	do {
-		found = false;
+	writeBlocks(stream, (const byte*)lengths.data(), lengths.size() * sizeof(uint64_t));
+}
 
-		for (const TrunkIndex& index : this->indices) {
-			if (index.uid == uid) {
-				found = true;
-				uid++;
-				break;
-			}
+bool FileTrunk::readStoredData(const TrunkIndex& index, std::vector<byte>& buffer) {
+	buffer.resize((size_t)index.length);
+	
+	if (index.length == 0) {
+		return true;
+	}
+	
+	if (index.data != NULL) {
+		memcpy(buffer.data(), index.data, buffer.size());
+		return true;
+	}
+	
+	return index.source != NULL && readStream(*index.source, index.sourcePosition, buffer.data(), buffer.size());
+}
+
+uint FileTrunk::getStoredChecksum(const TrunkIndex& index) {
+	if (index.trunkFlags & FTF_Checksum) {
+		return index.checksum;
+	}
+	
+	std::vector<byte> buffer;
+	readStoredData(index, buffer);
+	return crc32c(buffer.data(), buffer.size());
+}
+
+void FileTrunk::createDelta(const FileTrunk& base, const FileTrunk& target, FileStream& delta) {
+	std::vector<byte> baseData, targetData;
+	
+	std::map<std::pair<uint, uint>, const TrunkIndex*> baseIndices;
+	for (const TrunkIndex& index : base.indices) {
+		baseIndices.insert(std::make_pair(std::make_pair(index.uid, index.format), &index));
+	}
+	
+	// records are written as they are found, the header gets its magic and record count
+	// once all are written so that an unfinished delta is rejected
+	const size_t headerPosition = delta.getPosition();
+	DeltaHeader header = { };
+	header.ver = DELTA_VERSION;
+	delta.write(&header, sizeof(header));
+	
+	for (const TrunkIndex& index : target.indices) {
+		auto found = baseIndices.find(std::make_pair(index.uid, index.format));
+		const TrunkIndex* baseIndex = NULL;
+		
+		if (found != baseIndices.end()) {
+			baseIndex = found->second;
+			baseIndices.erase(found);
 		}
 		
-	} while (found);
-#elif UID_GENERATION_METHOD == UID_GM_RANDOMLY
-	
-	bool found;
-	do {
-		uid = ((uint)rand()) % 0xffffffff;
-		found = false;
+		if (!readStoredData(index, targetData)) {
+			throw FileException("cannot read trunk data");
+		}
 		
-		for (const TrunkIndex& index : this->indices) {
-			if (index.uid == uid) {
-				found = true;
-				break;
+		DeltaRecord record = { };
+		record.operation = DO_Add;
+		record.uid = index.uid;
+		record.format = index.format;
+		record.trunkFlags = index.trunkFlags & ~FTF_Checksum;
+		record.userFlags = index.userFlags;
+		record.checksum = crc32c(targetData.data(), targetData.size());
+		record.length = index.length;
+		
+		if (baseIndex != NULL) {
+			if (!readStoredData(*baseIndex, baseData)) {
+				throw FileException("cannot read trunk data");
 			}
+			
+			// equal stored bytes and flags mean an equal trunk
+			if (baseData.size() == targetData.size()
+					&& (baseIndex->trunkFlags & FTF_Compress) == (index.trunkFlags & FTF_Compress)
+					&& baseIndex->userFlags == index.userFlags
+					&& memcmp(baseData.data(), targetData.data(), baseData.size()) == 0) {
+				continue;
+			}
+			
+			record.operation = DO_Change;
+			record.baseChecksum = crc32c(baseData.data(), baseData.size());
 		}
 		
-	} while (found);
+		delta.write(&record, sizeof(DeltaRecord));
+		writeBlocks(delta, targetData.data(), targetData.size());
+		header.recordCount++;
+	}
 	
-#endif /* UID_GENERATION_METHOD */
+	for (const auto& removed : baseIndices) {
+		const TrunkIndex& index = *removed.second;
+		
+		DeltaRecord record = { };
+		record.operation = DO_Remove;
+		record.uid = index.uid;
+		record.format = index.format;
+		record.baseChecksum = getStoredChecksum(index);
+		
+		delta.write(&record, sizeof(DeltaRecord));
+		header.recordCount++;
+	}
 	
-	return uid;
-}
-
-uint FileTrunk::newTrunk(const uint format) {
-	const uint uid = this->getAvailableUid();
-	TrunkIndex newIndex;
-	memset(&newIndex, 0, sizeof(newIndex));
-	newIndex.uid = uid;
-	newIndex.format = format;
-	this->indices.push_back(newIndex);
-	return uid;
+	const size_t endPosition = delta.getPosition();
+	header.magic = DELTA_MAGIC;
+	delta.setPosition(headerPosition);
+	delta.write(&header, sizeof(header));
+	delta.setPosition(endPosition);
 }
 
-const uint FileTrunk::getTrunkFormat(const uint uid) {
-	const TrunkIndex* index = this->getTrunkIndex(uid);
+bool FileTrunk::applyDelta(FileStream* delta) {
+	const size_t deltaLength = delta->getLength();
+	delta->setPosition(0);
 	
-	if (index == NULL) {
-		return 0;
+	DeltaHeader header;
+	if (delta->read(&header, sizeof(header)) < (int)sizeof(header)
+			|| header.magic != DELTA_MAGIC || header.ver != DELTA_VERSION) {
+		return false;
 	}
 	
-	return index->format;
-}
-
-const byte* FileTrunk::getTrunkData(const uint uid, const uint format, size_t* length) {
-	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	std::vector<DeltaRecord> records(header.recordCount);
+	std::vector<size_t> positions(header.recordCount);
+	std::vector<byte> buffer;
+	size_t position = sizeof(header);
 	
-	if (index == NULL || index->length <= 0 || index->data == NULL) {
-		if (length != NULL) {
-			*length = 0;
+	// check everything before the first change so that a delta of another base or a
+	// damaged download leaves the trunk as it is
+	for (uint i = 0; i < header.recordCount; i++) {
+		DeltaRecord& record = records[i];
+		
+		if (position > deltaLength || deltaLength - position < sizeof(DeltaRecord)
+				|| !readStream(*delta, position, &record, sizeof(DeltaRecord))) {
+			return false;
 		}
-		return NULL;
+		
+		position += sizeof(DeltaRecord);
+		positions[i] = position;
+		
+		const TrunkIndex* index = this->getTrunkIndex(record.uid, record.format);
+		
+		if (record.operation == DO_Add) {
+			if (index != NULL && index->format == record.format) return false;
+		} else if (record.operation == DO_Change || record.operation == DO_Remove) {
+			if (index == NULL || index->format != record.format
+					|| getStoredChecksum(*index) != record.baseChecksum) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+		
+		if (record.operation == DO_Remove) continue;
+		
+		if (record.length > deltaLength - position) {
+			return false;
+		}
+		
+		uint checksum = 0;
+		buffer.resize(65536);
+		delta->setPosition(position);
+		
+		for (uint64_t remaining = record.length; remaining > 0; ) {
+			const uint bytes = (uint)(remaining < buffer.size() ? remaining : buffer.size());
+			if (delta->read(buffer.data(), bytes) < (int)bytes) return false;
+			checksum = crc32c(buffer.data(), bytes, checksum);
+			remaining -= bytes;
+		}
+		
+		if (checksum != record.checksum) {
+			return false;
+		}
+		
+		position += (size_t)record.length;
 	}
 	
-	if (index->trunkFlags & FTF_Compress) {
-		MemoryStream ms;
-		DecompressStream cs(ms);
-		cs.write(index->data, index->length);
-		cs.flush();
+	bool sourceUsed = false;
+	
+	for (uint i = 0; i < header.recordCount; i++) {
+		const DeltaRecord& record = records[i];
 		
-		index->trunkFlags &= ~FTF_Compress;
-		delete [] index->data;
+		if (record.operation == DO_Remove) {
+			this->deleteTrunk(record.uid, record.format);
+			continue;
+		}
 		
-		index->length = (uint)ms.getLength();
-		index->data = new byte[index->length];
-		memcpy((void*)index->data, ms.getBuffer(), index->length);
+		this->setTrunkSource(record.uid, record.format, delta, positions[i], record.length,
+												 record.checksum, record.trunkFlags);
+		this->getTrunkIndex(record.uid, record.format)->userFlags = record.userFlags;
+		sourceUsed = true;
 	}
 	
-	if (length != NULL) {
-		*length = index->length;
+	if (!sourceUsed) {
+		delete delta;
 	}
 	
-	return index->data;
-}
-
-const size_t FileTrunk::getTrunkDataLength(const uint uid, const uint format) {
-	const TrunkIndex* index = this->getTrunkIndex(uid, format);
-	return (index == NULL || index->length <= 0 || index->data == NULL) ? 0 : index->length;
+	return true;
 }
 
-void FileTrunk::setTrunkData(TrunkIndex& index, const byte* data, const uint length) {
+size_t FileTrunk::getDeadBytes() const {
+	const bool isV1 = this->fileVersion < TrunkVersion2;
 	
-	if (index.data != NULL) {
-		delete [] index.data;
-		index.data = NULL;
-	}
+	const uint recordSize = isV1 ? TrunkIndexSizeV1
+		: TrunkIndexSize + ((this->fileFlags & TrunkHeaderDataLengths) ? (uint)sizeof(uint64_t) : 0);
 	
-	if (index.trunkFlags & FTF_Compress) {
-		MemoryStream ms;
-		CompressStream cs(ms);
-		cs.write(data, length);
-		cs.flush();
-		
-		index.data = new byte[ms.getLength()];
-		index.length = (uint)ms.getLength();
-		memcpy((void*)index.data, (void*)ms.getBuffer(), ms.getLength());
-		index.compressed = true;
-	} else {
-		index.data = new byte[length];
-		index.length = length;
-		memcpy((void*)index.data, (void*)data, length);
+	uint64_t liveBytes = (isV1 ? TrunkHeaderSizeV1 : sizeof(TrunkHeader)) + (uint64_t)recordSize * this->indices.size();
+	
+	std::map<BlockKey, bool> blocks;
+	
+	for (const TrunkIndex& index : this->indices) {
+		if (index.stored && blocks.insert(std::make_pair(getBlockKey(index), true)).second) {
+			liveBytes += index.length;
+		}
 	}
+	
+	return this->fileLength > liveBytes ? (size_t)(this->fileLength - liveBytes) : 0;
 }
 
-void FileTrunk::setTrunkData(const uint uid, const uint format, const byte* data, const uint length, uint flags) {
-	TrunkIndex* index = this->getTrunkIndex(uid, format);
+uint64_t FileTrunk::getSaveLength() const {
+	uint64_t length = sizeof(TrunkHeader) + (uint64_t)(TrunkIndexSize + sizeof(uint64_t)) * this->indices.size();
+	std::map<BlockKey, bool> blocks;
 	
-	if (index == NULL) {
-		TrunkIndex newIndex;
-		memset(&newIndex, 0, sizeof(newIndex));
-		this->indices.push_back(newIndex);
-		index = &this->indices.back();
+	for (const TrunkIndex& index : this->indices) {
+		if (index.length > 0 && blocks.insert(std::make_pair(getBlockKey(index), true)).second) {
+			length += index.length;
+		}
 	}
 	
-	index->uid = uid;
-	index->format = format;
-	index->trunkFlags = flags;
+	return length;
+}
+
+void FileTrunk::clear() {
+	this->cache.clear();
 	
-	if (data != NULL && length > 0) {
-		this->setTrunkData(*index, data, length);
+	for (TrunkIndex& index : this->indices) {
+		this->releaseTrunkData(index);
 	}
+	this->indices.clear();
+	this->sharedData.clear();
+	this->contentBlocks.clear();
+	this->storedBlocks.clear();
+	this->uidAllocator->reset();
+	this->releaseSpillStreams(true);
+	this->residentTrunks.clear();
+	this->residentBytes = 0;
+	this->source = NULL;
+	this->fileStartPosition = 0;
+	this->fileLength = 0;
+	this->fileVersion = 0;
+	this->fileFlags = 0;
 }
 
-bool FileTrunk::deleteTrunk(const uint uid, const uint format) {
-	const TrunkIndex* index = this->getTrunkIndex(uid, format);
+void FileTrunk::detach() {
+	for (TrunkIndex& index : this->indices) {
+		if (index.source != NULL && index.source == this->source) {
+			if (index.data == NULL && !this->loadTrunkData(index)) {
+				this->removeContentKeys(index);
+				index.length = 0;
+			}
+			
+			// spilled data keeps its temporary file and can still be dropped
+			this->removeResidentTrunk(index);
+			index.source = NULL;
+		}
+	}
 	
-	if (index == NULL) {
-		return false;
+	this->source = NULL;
+}
+
+void FileTrunk::attach(FileStream& stream) {
+	for (TrunkIndex& index : this->indices) {
+		if (index.stored && index.length > 0) {
+			index.source = &stream;
+			index.sourcePosition = this->fileStartPosition + index.offset;
+			
+			if (index.data != NULL) {
+				this->addResidentTrunk(index);
+			}
+		} else if (index.source != NULL && index.source == this->source) {
+			this->removeResidentTrunk(index);
+			index.source = NULL;
+		}
 	}
 	
-	auto pos = std::find(this->indices.begin(), this->indices.end(), *index);
+	this->source = &stream;
+	this->evictTrunks(NULL);
+	this->releaseSpillStreams();
+}
+
+void FileTrunk::releaseSpillStreams(const bool all) {
+	for (size_t i = this->spillStreams.size(); i-- > 0; ) {
+		FileStream* spill = this->spillStreams[i];
+		bool used = false;
+		
+		for (const TrunkIndex& index : this->indices) {
+			if (!all && index.source == spill) {
+				used = true;
+				break;
+			}
+		}
+		
+		if (!used) {
+			delete spill;
+			this->spillStreams.erase(this->spillStreams.begin() + i);
+		}
+	}
+}
+
+void FileTrunk::setResidentLimit(const size_t bytes) {
+	this->residentLimit = bytes;
+	this->evictTrunks(NULL);
+}
+
+bool FileTrunk::loadTrunkData(TrunkIndex& index) {
+	if (index.source == NULL || index.length == 0) {
+		return false;
+	}
+	
+	if (index.length > (uint64_t)(size_t)-1) {
+		return false;
+	}
+	
+	byte* buffer = new byte[(size_t)index.length];
+	
+	if (!readStream(*index.source, index.sourcePosition, buffer, (size_t)index.length)) {
+		delete [] buffer;
+		return false;
+	}
+	
+	if (!this->isTrunkDataValid(index, buffer)) {
+		delete [] buffer;
+		throw TrunkChecksumException(index.uid, index.format);
+	}
+	
+	index.data = buffer;
+	this->addResidentTrunk(index);
+	return true;
+}
+
+bool FileTrunk::isTrunkDataValid(const TrunkIndex& index, const byte* data) const {
+	return !(index.trunkFlags & FTF_Checksum)
+		|| crc32c(data, (size_t)index.length) == index.checksum;
+}
+
+void FileTrunk::releaseTrunkData(TrunkIndex& index) {
+	if (index.data != NULL) {
+		this->removeResidentTrunk(index);
+		this->releaseData(index.data);
+		index.data = NULL;
+	}
+}
+
+void FileTrunk::retainData(const byte* data) {
+	uint& refs = this->sharedData[data];
+	refs = refs == 0 ? 2 : refs + 1;
+}
+
+void FileTrunk::releaseData(const byte* data) {
+	auto shared = this->sharedData.find(data);
+	
+	if (shared == this->sharedData.end()) {
+		delete [] data;
+	} else if (--shared->second < 2) {
+		// the remaining owner is the only one again
+		this->sharedData.erase(shared);
+	}
+}
+
+void FileTrunk::evictTrunks(const TrunkIndex* keep) {
+	// keep was just used and is first in the list
+	while (this->residentLimit > 0 && this->residentBytes > this->residentLimit
+				 && !this->residentTrunks.empty() && this->residentTrunks.back() != keep) {
+		this->releaseTrunkData(*this->residentTrunks.back());
+	}
+}
+
+void FileTrunk::addResidentTrunk(TrunkIndex& index) {
+	if (index.resident) return;
+	
+	this->residentTrunks.push_front(&index);
+	index.residentEntry = this->residentTrunks.begin();
+	index.resident = true;
+	this->residentBytes += (size_t)index.length;
+}
+
+void FileTrunk::removeResidentTrunk(TrunkIndex& index) {
+	if (!index.resident) return;
+	
+	this->residentTrunks.erase(index.residentEntry);
+	index.resident = false;
+	this->residentBytes -= (size_t)index.length;
+}
+
+void FileTrunk::touchResidentTrunk(TrunkIndex& index) {
+	if (index.resident) {
+		this->residentTrunks.splice(this->residentTrunks.begin(), this->residentTrunks, index.residentEntry);
+	}
+}
+
+void FileTrunk::relinkIndices() {
+	this->contentBlocks.clear();
+	this->storedBlocks.clear();
+	
+	for (TrunkIndex& index : this->indices) {
+		if (index.resident) {
+			*index.residentEntry = &index;
+		}
+		
+		this->addContentKeys(index);
+	}
+}
+
+bool FileTrunk::unloadTrunk(const uint uid, const uint format) {
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL || index->source == NULL || index->data == NULL) {
+		return false;
+	}
+	
+	this->releaseTrunkData(*index);
+	return true;
+}
+
+FileTrunk::TrunkIndex& FileTrunk::addTrunkIndex(const TrunkIndex& index) {
+	const TrunkIndex* previous = this->indices.data();
+	this->indices.push_back(index);
+	
+	if (this->indices.data() != previous) {
+		this->relinkIndices();
+	}
+	
+	return this->indices.back();
+}
+
+FileTrunk::TrunkIndex* FileTrunk::getTrunkIndex(const uint uid, const uint format) {
+	for (TrunkIndex& index : this->indices) {
+		if (index.uid == uid) {
+			if (format == 0 || index.format == format) {
+				return &index;
+			}
+		}
+	}
+	
+	return NULL;
+}
+
+void FileTrunk::setUidAllocator(UidAllocator* allocator) {
+	if (allocator == this->uidAllocator) return;
+	
+	delete this->uidAllocator;
+	this->uidAllocator = allocator;
+	
+	for (const TrunkIndex& index : this->indices) {
+		this->uidAllocator->use(index.uid);
+	}
+}
+
+uint FileTrunk::getAvailableUid() {
+	return this->uidAllocator->allocate();
+}
+
+uint FileTrunk::newTrunk(const uint format) {
+	const uint uid = this->getAvailableUid();
+	TrunkIndex newIndex = TrunkIndex();
+	newIndex.uid = uid;
+	newIndex.format = format;
+	this->addTrunkIndex(newIndex);
+	this->uidAllocator->use(uid);
+	return uid;
+}
+
+const uint FileTrunk::getTrunkFormat(const uint uid) {
+	const TrunkIndex* index = this->getTrunkIndex(uid);
+	
+	if (index == NULL) {
+		return 0;
+	}
+	
+	return index->format;
+}
+
+const byte* FileTrunk::getTrunkData(const uint uid, const uint format, size_t* length) {
+	std::lock_guard<std::mutex> guard(this->stateLock);
+	
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL) {
+		if (length != NULL) {
+			*length = 0;
+		}
+		return NULL;
+	}
+	
+	if (this->accessTrace == NULL) {
+		return this->readTrunk(index, length);
+	}
+	
+	AccessTrace::Record access = { };
+	size_t dataLength;
+	const byte* data = this->readTrunk(index, &dataLength, &access);
+	this->accessTrace->record(uid, index->format, dataLength, access.decompressTime, access.flags);
+	
+	if (length != NULL) {
+		*length = dataLength;
+	}
+	
+	return data;
+}
+
+const byte* FileTrunk::readTrunk(TrunkIndex* index, size_t* length, AccessTrace::Record* access) {
+	if (index->data == NULL && index->source != NULL) {
+		this->loadTrunkData(*index);
+		
+		if (access != NULL) {
+			access->flags |= AccessTrace::ATF_Loaded;
+		}
+	}
+	
+	if (index->length <= 0 || index->data == NULL) {
+		if (length != NULL) {
+			*length = 0;
+		}
+		return NULL;
+	}
+	
+	this->touchResidentTrunk(*index);
+	
+	const byte* data = index->data;
+	size_t dataLength = (size_t)index->length;
+	
+	if (index->trunkFlags & FTF_Compress) {
+		data = this->cache.get(index->uid, index->format, &dataLength);
+		
+		if (data == NULL) {
+			const auto start = std::chrono::steady_clock::now();
+			
+			byte* buffer = decompressData(index->data, (size_t)index->length, &dataLength);
+			data = this->cache.put(index->uid, index->format, buffer, dataLength);
+			index->dataLength = dataLength;
+			
+			if (access != NULL) {
+				access->decompressTime = getElapsedMicroseconds(start);
+			}
+		} else if (access != NULL) {
+			access->flags |= AccessTrace::ATF_Cached;
+		}
+	}
+	
+	this->evictTrunks(index);
+	
+	if (length != NULL) {
+		*length = dataLength;
+	}
+	
+	return data;
+}
+
+const size_t FileTrunk::getTrunkDataLength(const uint uid, const uint format) {
+	std::lock_guard<std::mutex> guard(this->stateLock);
+	
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL || index->length <= 0
+			|| (index->data == NULL && index->source == NULL)) {
+		return 0;
+	}
+	
+	if (!(index->trunkFlags & FTF_Compress)) {
+		return (size_t)index->length;
+	}
+	
+	// known unless the trunk came from a file without data lengths and was never read
+	if (index->dataLength > 0) {
+		return (size_t)index->dataLength;
+	}
+	
+	size_t length;
+	this->readTrunk(index, &length);
+	return length;
+}
+
+bool FileTrunk::readTrunkData(const uint uid, const uint format, Stream& output) {
+	std::unique_lock<std::mutex> guard(this->stateLock);
+	
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL) {
+		return false;
+	}
+	
+	AccessTrace* trace = this->accessTrace;
+	uint accessFlags = AccessTrace::ATF_None;
+	
+	if (index->data == NULL && index->source != NULL) {
+		this->loadTrunkData(*index);
+		accessFlags |= AccessTrace::ATF_Loaded;
+	}
+	
+	if (index->length <= 0 || index->data == NULL) {
+		return false;
+	}
+	
+	this->touchResidentTrunk(*index);
+	
+	const bool compressed = (index->trunkFlags & FTF_Compress) != 0;
+	
+	if (compressed) {
+		size_t cachedLength;
+		std::shared_ptr<const byte> cached = this->cache.acquire(index->uid, index->format, &cachedLength);
+		
+		if (cached) {
+			const uint cachedFormat = index->format;
+			guard.unlock();
+			writeBlocks(output, cached.get(), cachedLength);
+			
+			if (trace != NULL) {
+				trace->record(uid, cachedFormat, cachedLength, 0, accessFlags | AccessTrace::ATF_Cached);
+			}
+			return true;
+		}
+	}
+	
+	// keep the stored bytes alive while the lock is released, eviction by other readers
+	// only drops the reference of the index
+	const byte* data = index->data;
+	const size_t length = (size_t)index->length;
+	const uint cacheUid = index->uid, cacheFormat = index->format;
+	
+	this->retainData(data);
+	this->evictTrunks(index);
+	guard.unlock();
+	
+	byte* buffer = NULL;
+	size_t bufferLength = 0;
+	uint decompressTime = 0;
+	
+	try {
+		if (compressed) {
+			const auto start = std::chrono::steady_clock::now();
+			
+			buffer = decompressData(data, length, &bufferLength);
+			decompressTime = getElapsedMicroseconds(start);
+			writeBlocks(output, buffer, bufferLength);
+		} else {
+			writeBlocks(output, data, length);
+		}
+	} catch (...) {
+		delete [] buffer;
+		guard.lock();
+		this->releaseData(data);
+		throw;
+	}
+	
+	if (trace != NULL) {
+		trace->record(uid, cacheFormat, compressed ? bufferLength : length, decompressTime, accessFlags);
+	}
+	
+	guard.lock();
+	this->releaseData(data);
+	
+	if (buffer != NULL) {
+		this->cache.put(cacheUid, cacheFormat, buffer, bufferLength);
+	}
+	
+	return true;
+}
+
+void FileTrunk::hashTrunkData(PreparedTrunkData& prepared) {
+	prepared.hash = xxhash64(prepared.data, prepared.length);
+}
+
+void FileTrunk::prepareTrunkData(PreparedTrunkData& prepared) {
+	if (prepared.stored != NULL || prepared.data == NULL || prepared.length == 0) {
+		return;
+	}
+	
+	if (prepared.flags & FTF_Compress) {
+		MemoryStream ms;
+		CompressStream cs(ms);
+		writeBlocks(cs, prepared.data, prepared.length);
+		cs.flush();
+		
+		prepared.storedLength = ms.getLength();
+		prepared.stored = new byte[prepared.storedLength];
+		memcpy(prepared.stored, ms.getBuffer(), prepared.storedLength);
+	} else {
+		prepared.storedLength = prepared.length;
+		prepared.stored = new byte[prepared.length];
+		memcpy(prepared.stored, prepared.data, prepared.length);
+	}
+	
+	prepared.checksum = crc32c(prepared.stored, prepared.storedLength);
+}
+
+void FileTrunk::setTrunkData(TrunkIndex& index, PreparedTrunkData& prepared) {
+	const FileStream* previousSource = index.source;
+	
+	this->cache.remove(index.uid, index.format);
+	this->releaseTrunkData(index);
+	this->removeContentKeys(index);
+	index.source = NULL;
+	index.stored = false;
+	index.contentHash = 0;
+	
+	uint64_t hash = 0;
+	
+	if (previousSource != NULL && previousSource != this->source) {
+		this->releaseSpillStreams();
+	}
+	
+	if (this->deduplicate) {
+		hash = prepared.hash != 0 ? prepared.hash : xxhash64(prepared.data, prepared.length);
+		
+		if (this->shareTrunkData(index, prepared.data, prepared.length, hash)) {
+			index.dataLength = prepared.length;
+			this->addContentKeys(index);
+			return;
+		}
+	}
+	
+	// compressed here unless done ahead by the caller
+	prepared.flags = index.trunkFlags;
+	prepareTrunkData(prepared);
+	
+	index.data = prepared.stored;
+	index.length = prepared.storedLength;
+	index.compressed = (index.trunkFlags & FTF_Compress) != 0;
+	index.checksum = prepared.checksum;
+	index.trunkFlags |= FTF_Checksum;
+	prepared.stored = NULL;
+	index.contentHash = hash;
+	
+	// payloads from a file or set before deduplication was enabled have no hash,
+	// they are found by the checksum of their stored bytes
+	if (this->deduplicate) {
+		this->shareStoredTrunkData(index);
+	}
+	
+	index.dataLength = prepared.length;
+	this->addContentKeys(index);
+}
+
+void FileTrunk::setDeduplicate(const bool enabled) {
+	this->deduplicate = enabled;
+	this->relinkIndices();
+}
+
+bool FileTrunk::listsBlock(const BlockMap& blocks, const uint64_t key, const TrunkIndex& index) {
+	// equal keys are next to each other
+	for (auto it = blocks.find(key); it != blocks.end() && it->first == key; ++it) {
+		if (getBlockKey(*it->second) == getBlockKey(index)) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+void FileTrunk::unlistBlock(BlockMap& blocks, const uint64_t key, const TrunkIndex& index) {
+	for (auto it = blocks.find(key); it != blocks.end() && it->first == key; ++it) {
+		if (it->second == &index) {
+			blocks.erase(it);
+			return;
+		}
+	}
+}
+
+void FileTrunk::addContentKeys(TrunkIndex& index) {
+	if (!this->deduplicate || index.length == 0) return;
+	
+	// trunks sharing a block already listed are found through that one
+	if (index.contentHash != 0 && !listsBlock(this->contentBlocks, index.contentHash, index)) {
+		this->contentBlocks.insert(std::make_pair(index.contentHash, &index));
+	}
+	
+	if ((index.trunkFlags & FTF_Checksum) && !listsBlock(this->storedBlocks, getStoredKey(index), index)) {
+		this->storedBlocks.insert(std::make_pair(getStoredKey(index), &index));
+	}
+}
+
+void FileTrunk::removeContentKeys(TrunkIndex& index) {
+	if (!this->deduplicate) return;
+	
+	unlistBlock(this->contentBlocks, index.contentHash, index);
+	unlistBlock(this->storedBlocks, getStoredKey(index), index);
+}
+
+bool FileTrunk::matchesPayload(TrunkIndex& block, const byte* data, const size_t length) {
+	// compare with data already cached or the stored bytes, without the read counting as
+	// a use of the block in the cache or the access trace
+	size_t blockLength;
+	const byte* cached = (block.trunkFlags & FTF_Compress) ? this->cache.peek(block.uid, block.format, &blockLength) : NULL;
+	
+	if (cached != NULL) {
+		return blockLength == length && memcmp(cached, data, length) == 0;
+	}
+	
+	if (block.data == NULL && !this->loadTrunkData(block)) {
+		return false;
+	}
+	
+	if (!(block.trunkFlags & FTF_Compress)) {
+		return block.length == length && memcmp(block.data, data, length) == 0;
+	}
+	
+	std::unique_ptr<byte[]> payload(decompressData(block.data, (size_t)block.length, &blockLength));
+	return blockLength == length && memcmp(payload.get(), data, length) == 0;
+}
+
+bool FileTrunk::shareTrunkData(TrunkIndex& index, const byte* data, const size_t length, const uint64_t hash) {
+	for (auto it = this->contentBlocks.find(hash); it != this->contentBlocks.end() && it->first == hash; ++it) {
+		TrunkIndex& block = *it->second;
+		
+		if (&block == &index || block.contentHash != hash || block.length == 0
+				|| (block.trunkFlags & FTF_Compress) != (index.trunkFlags & FTF_Compress)) {
+			continue;
+		}
+		
+		// the hash only selects the candidate, compare the payload to be sure
+		if (this->matchesPayload(block, data, length)) {
+			this->shareTrunkData(index, block);
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+bool FileTrunk::shareStoredTrunkData(TrunkIndex& index) {
+	const uint64_t key = getStoredKey(index);
+	
+	for (auto it = this->storedBlocks.find(key); it != this->storedBlocks.end() && it->first == key; ++it) {
+		TrunkIndex& block = *it->second;
+		
+		if (&block == &index || !(block.trunkFlags & FTF_Checksum)
+				|| block.checksum != index.checksum || block.length != index.length
+				|| (block.trunkFlags & FTF_Compress) != (index.trunkFlags & FTF_Compress)) {
+			continue;
+		}
+		
+		if (block.data == NULL && !this->loadTrunkData(block)) {
+			continue;
+		}
+		
+		if (memcmp(block.data, index.data, (size_t)index.length) == 0) {
+			const uint64_t hash = index.contentHash;
+			this->releaseTrunkData(index);
+			this->shareTrunkData(index, block);
+			
+			// the block is found by the hash of the payload from now on
+			this->removeContentKeys(block);
+			index.contentHash = block.contentHash = hash;
+			this->addContentKeys(block);
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+void FileTrunk::shareTrunkData(TrunkIndex& index, TrunkIndex& block) {
+	index.data = block.data;
+	index.length = block.length;
+	index.compressed = block.compressed;
+	index.checksum = block.checksum;
+	index.trunkFlags = (index.trunkFlags & ~FTF_Checksum) | (block.trunkFlags & FTF_Checksum);
+	index.contentHash = block.contentHash;
+	index.dataLength = block.dataLength;
+	
+	// a stored block needs no writing until one of the trunks changes
+	index.stored = block.stored;
+	index.offset = block.offset;
+	index.source = block.source;
+	index.sourcePosition = block.sourcePosition;
+	
+	if (index.data != NULL) {
+		this->retainData(index.data);
+		
+		if (index.source != NULL) {
+			this->addResidentTrunk(index);
+		}
+	}
+}
+
+bool FileTrunk::prefetchTrunk(const uint uid, const uint format, size_t* length) {
+	std::unique_lock<std::mutex> guard(this->stateLock);
+	
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL) {
+		return false;
+	}
+	
+	if (index->data == NULL && index->source != NULL) {
+		this->loadTrunkData(*index);
+		this->evictTrunks(index);
+	}
+	
+	if (index->length <= 0 || index->data == NULL) {
+		return false;
+	}
+	
+	if (!(index->trunkFlags & FTF_Compress)) {
+		*length = (size_t)index->length;
+		return true;
+	}
+	
+	if (this->cache.touch(index->uid, index->format, length)) {
+		return true;
+	}
+	
+	// decompress outside the lock like readTrunkData
+	const byte* data = index->data;
+	const size_t storedLength = (size_t)index->length;
+	const uint cacheUid = index->uid, cacheFormat = index->format;
+	
+	this->retainData(data);
+	guard.unlock();
+	
+	byte* buffer;
+	
+	try {
+		buffer = decompressData(data, storedLength, length);
+	} catch (...) {
+		guard.lock();
+		this->releaseData(data);
+		throw;
+	}
+	
+	guard.lock();
+	this->releaseData(data);
+	this->cache.put(cacheUid, cacheFormat, buffer, *length);
+	
+	return true;
+}
+
+void FileTrunk::setTrunkData(const uint uid, const uint format, const byte* data, const size_t length, uint flags) {
+	PreparedTrunkData prepared;
+	prepared.data = data;
+	prepared.length = length;
+	prepared.flags = flags;
+	
+	this->setTrunkData(uid, format, prepared);
+}
+
+void FileTrunk::setTrunkData(const uint uid, const uint format, PreparedTrunkData& prepared) {
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL) {
+		index = &this->addTrunkIndex(TrunkIndex());
+		this->uidAllocator->use(uid);
+	}
+	
+	index->uid = uid;
+	index->format = format;
+	// the checksum still describes the current data until it is replaced
+	index->trunkFlags = (prepared.flags & ~FTF_Checksum) | (index->trunkFlags & FTF_Checksum);
+	
+	if (prepared.data != NULL && prepared.length > 0) {
+		this->setTrunkData(*index, prepared);
+	}
+	
+	// not used when the data is shared with another trunk
+	delete [] prepared.stored;
+	prepared.stored = NULL;
+}
+
+bool FileTrunk::deleteTrunk(const uint uid, const uint format) {
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL) {
+		return false;
+	}
+	
+	this->cache.remove(index->uid, index->format);
+	this->releaseTrunkData(*index);
+	
+	const FileStream* previousSource = index->source;
+	auto pos = std::find(this->indices.begin(), this->indices.end(), *index);
 	
 	this->indices.erase(pos);
+	this->relinkIndices();
+	
+	// another format of the trunk may still hold the uid
+	if (this->getTrunkIndex(uid) == NULL) {
+		this->uidAllocator->release(uid);
+	}
+	
+	if (previousSource != NULL && previousSource != this->source) {
+		this->releaseSpillStreams();
+	}
 	
 	return true;
 }
 
+void FileTrunk::sortTrunks(const std::vector<uint>& accessOrder) {
+	std::unordered_map<uint, size_t> ranks;
+	ranks.reserve(accessOrder.size());
+	
+	for (size_t i = 0; i < accessOrder.size(); i++) {
+		// the first access counts
+		ranks.insert(std::make_pair(accessOrder[i], i));
+	}
+	
+	const size_t unlisted = accessOrder.size();
+	
+	std::stable_sort(this->indices.begin(), this->indices.end(),
+									 [&ranks, unlisted](const TrunkIndex& a, const TrunkIndex& b) {
+		const auto ra = ranks.find(a.uid), rb = ranks.find(b.uid);
+		return (ra != ranks.end() ? ra->second : unlisted) < (rb != ranks.end() ? rb->second : unlisted);
+	});
+	
+	this->relinkIndices();
+}
+
+void FileTrunk::sortTrunksByFormat() {
+	std::stable_sort(this->indices.begin(), this->indices.end(),
+									 [](const TrunkIndex& a, const TrunkIndex& b) {
+		return a.format < b.format;
+	});
+	
+	this->relinkIndices();
+}
+
+void FileTrunk::setTrunkSource(const uint uid, const uint format, FileStream* source, const size_t position,
+															 const uint64_t length, const uint checksum, uint flags, const uint64_t dataLength) {
+	if (std::find(this->spillStreams.begin(), this->spillStreams.end(), source) == this->spillStreams.end()) {
+		this->spillStreams.push_back(source);
+	}
+	
+	TrunkIndex* index = this->getTrunkIndex(uid, format);
+	
+	if (index == NULL) {
+		index = &this->addTrunkIndex(TrunkIndex());
+		this->uidAllocator->use(uid);
+	} else {
+		this->cache.remove(index->uid, index->format);
+		this->releaseTrunkData(*index);
+		this->removeContentKeys(*index);
+	}
+	
+	index->uid = uid;
+	index->format = format;
+	index->trunkFlags = flags | FTF_Checksum;
+	index->checksum = checksum;
+	index->length = length;
+	index->compressed = (flags & FTF_Compress) != 0;
+	index->contentHash = 0;
+	index->dataLength = dataLength;
+	index->stored = false;
+	index->source = source;
+	index->sourcePosition = position;
+	this->addContentKeys(*index);
+	
+	this->releaseSpillStreams();
+}
+
+bool FileTrunk::verify(const std::vector<FileStream*>& streams, std::vector<uint>* corruptedUids) const {
+	// read in file order so that every stream mostly moves forward
+	std::vector<const TrunkIndex*> trunks;
+	
+	for (const TrunkIndex& index : this->indices) {
+		if (index.stored && index.length > 0 && (index.trunkFlags & FTF_Checksum)) {
+			trunks.push_back(&index);
+		}
+	}
+	
+	std::sort(trunks.begin(), trunks.end(), [](const TrunkIndex* a, const TrunkIndex* b) {
+		return a->offset < b->offset;
+	});
+	
+	// shared data blocks are checked once
+	trunks.erase(std::unique(trunks.begin(), trunks.end(), [](const TrunkIndex* a, const TrunkIndex* b) {
+		return a->offset == b->offset && a->length == b->length && a->checksum == b->checksum;
+	}), trunks.end());
+	
+	std::atomic<size_t> next(0);
+	std::mutex resultLock;
+	bool valid = true;
+	
+	auto worker = [&](FileStream* stream) {
+		std::vector<byte> buffer(0x100000);
+		
+		for (size_t i = next++; i < trunks.size(); i = next++) {
+			const TrunkIndex& index = *trunks[i];
+			size_t position = this->fileStartPosition + (size_t)index.offset;
+			uint64_t remaining = index.length;
+			uint crc = 0;
+			
+			try {
+				while (remaining > 0) {
+					const size_t bytes = (size_t)(remaining < buffer.size() ? remaining : buffer.size());
+					if (!readStream(*stream, position, buffer.data(), bytes)) break;
+					
+					crc = crc32c(buffer.data(), bytes, crc);
+					position += bytes;
+					remaining -= bytes;
+				}
+			} catch (...) {
+			}
+			
+			if (remaining > 0 || crc != index.checksum) {
+				std::lock_guard<std::mutex> guard(resultLock);
+				valid = false;
+				
+				if (corruptedUids != NULL) {
+					corruptedUids->push_back(index.uid);
+				}
+			}
+		}
+	};
+	
+	std::vector<std::thread> threads;
+	
+	for (size_t i = 1; i < streams.size(); i++) {
+		threads.push_back(std::thread(worker, streams[i]));
+	}
+	
+	if (!streams.empty()) {
+		worker(streams[0]);
+	}
+	
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	
+	return valid && (!streams.empty() || trunks.empty());
+}
+
 }
 
-#undef UID_GM_SEQUENTIALLY
-#undef UID_GM_RANDOMLY
-#undef UID_GENERATION_METHOD
+#undef JOURNAL_RECORD_MAGIC
+#undef DELTA_MAGIC
+#undef DELTA_VERSION
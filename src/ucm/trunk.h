@@ -10,25 +10,46 @@
 
 #include "types.h"
 #include "file.h"
+#include "trunkcache.h"
+#include "uidallocator.h"
+#include "accesstrace.h"
 
 #include <stdio.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 namespace ucm {
 
+// Reading trunks with getTrunkFormat, getTrunkDataLength, readTrunkData and prefetchTrunk may
+// happen from many threads at once, all other members need exclusive access. getTrunkData
+// returns memory that another read can drop, concurrent readers use readTrunkData instead.
 class FileTrunk {
 private:
+	// version 1 ends after _reserved and its index table is located at headerSize,
+	// version 2 locates the index table by indexOffset
 	struct TrunkHeader {
 		uint headerSize;
 		ushort ver;
 		ushort flags;
 		uint trunkCount;
 		uint _reserved;
+		uint64_t indexOffset;
+		uint64_t _reserved2;
 	};
 	
-	static constexpr uint TrunkIndexSize = (uint)sizeof(uint) * 6;
+	static constexpr ushort TrunkVersion1 = 0x0100;
+	static constexpr ushort TrunkVersion2 = 0x0200;
 	
-	struct TrunkIndex {
+	// version 2 header flag, the index table is followed by the uncompressed length of
+	// every trunk as uint64_t, 0 when unknown; readers not knowing the flag skip the table
+	static constexpr ushort TrunkHeaderDataLengths = 0x1;
+	static constexpr uint TrunkHeaderSizeV1 = (uint)sizeof(uint) * 4;
+	
+	struct TrunkIndexV1 {
 		uint uid;
 		uint format;
 		uint offset;
@@ -36,11 +57,55 @@ private:
 		ushort trunkFlags;
 		ushort userFlags;
 		uint _reserved;
+	};
+	
+	static constexpr uint TrunkIndexSizeV1 = (uint)sizeof(uint) * 6;
+	
+	// version 2 index records, naturally aligned so two records share a cache line
+	struct TrunkIndexV2 {
+		uint uid;
+		uint format;
+		uint64_t offset;
+		uint64_t length;
+		ushort trunkFlags;
+		ushort userFlags;
+		uint checksum;
+	};
+	
+	static constexpr uint TrunkIndexSize = 32;
+	static_assert(sizeof(TrunkIndexV2) == TrunkIndexSize, "version 2 index records are 32 bytes");
+	
+	struct TrunkIndex {
+		uint uid;
+		uint format;
+		uint64_t offset;
+		uint64_t length;
+		ushort trunkFlags;
+		ushort userFlags;
+		uint checksum;
 		
 		struct {
 			const byte* data = NULL;
 			bool compressed = false;
+			
+			// stream to read the trunk bytes from when they are not in memory (lazy load)
+			FileStream* source = NULL;
+			size_t sourcePosition = 0;
+			
+			// data can be dropped and read again, listed in residentTrunks
+			bool resident = false;
+			
+			// data is at offset of the file this trunk was last loaded from or saved to
+			bool stored = false;
+			
+			// xxHash of the uncompressed payload when set in this session, 0 if unknown
+			uint64_t contentHash = 0;
+			
+			// length of the uncompressed payload, 0 if unknown
+			uint64_t dataLength = 0;
 		};
+		
+		std::list<TrunkIndex*>::iterator residentEntry;
 
 		bool operator==(const TrunkIndex& t2) const {
 			return this->uid == t2.uid && this->format == t2.format;
@@ -50,35 +115,263 @@ private:
 	
 	std::vector<TrunkIndex> indices;
 	TrunkIndex* getTrunkIndex(const uint uid, const uint format = 0);
-	void setTrunkData(TrunkIndex& index, const byte* data, const uint length);
+	TrunkIndex& addTrunkIndex(const TrunkIndex& index);
+	
+	// content deduplication, data blocks referenced by more than one index and their
+	// reference count; identical stored blocks are recognized by their offset
+	bool deduplicate = false;
+	std::unordered_map<const byte*, uint> sharedData;
+	
+	// candidates to share data with while deduplicating, one trunk per data block by the
+	// hash of its payload and by the checksum and length of its stored bytes
+	typedef std::unordered_multimap<uint64_t, TrunkIndex*> BlockMap;
+	BlockMap contentBlocks;
+	BlockMap storedBlocks;
+	
+	static inline uint64_t getStoredKey(const TrunkIndex& index) {
+		return ((uint64_t)index.checksum << 32) ^ index.length;
+	}
+	
+	static bool listsBlock(const BlockMap& blocks, const uint64_t key, const TrunkIndex& index);
+	static void unlistBlock(BlockMap& blocks, const uint64_t key, const TrunkIndex& index);
+	void addContentKeys(TrunkIndex& index);
+	void removeContentKeys(TrunkIndex& index);
+	bool matchesPayload(TrunkIndex& block, const byte* data, const size_t length);
+	
+	void retainData(const byte* data);
+	void releaseData(const byte* data);
+	bool shareTrunkData(TrunkIndex& index, const byte* data, const size_t length, const uint64_t hash);
+	bool shareStoredTrunkData(TrunkIndex& index);
+	void shareTrunkData(TrunkIndex& index, TrunkIndex& block);
+	
+	// identifies the data block of an index by its origin, position and length, trunks with
+	// equal keys are saved once; the origin is NULL for blocks in the bound file
+	typedef std::tuple<const void*, uint64_t, uint64_t> BlockKey;
+	static inline BlockKey getBlockKey(const TrunkIndex& index) {
+		if (index.stored) return BlockKey(NULL, index.offset, index.length);
+		if (index.data != NULL) return BlockKey(index.data, 0, index.length);
+		return BlockKey(index.source, index.sourcePosition, index.length);
+	}
+	
+	// temporary files holding data written by setTrunkSource until it is saved
+	std::vector<FileStream*> spillStreams;
+	void releaseSpillStreams(const bool all = false);
+	
+	// decompressed data, the compressed bytes in index stay the canonical copy
+	TrunkDataCache cache;
+	
+	size_t residentLimit = 0;
+	size_t residentBytes = 0;
+	
+	// trunks whose data can be dropped, most recently used first
+	std::list<TrunkIndex*> residentTrunks;
+	
+	// lazy load source, and the region of the file last loaded from or saved to
+	FileStream* source = NULL;
+	size_t fileStartPosition = 0;
+	size_t fileLength = 0;
+	ushort fileVersion = 0;
+	ushort fileFlags = 0;
+	
+	// guards lazy loading, residency and the cache while trunks are read concurrently
+	std::mutex stateLock;
+	
+	UidAllocator* uidAllocator;
+	AccessTrace* accessTrace = NULL;
+	
+	const byte* readTrunk(TrunkIndex* index, size_t* length, AccessTrace::Record* access = NULL);
+	bool loadTrunkData(TrunkIndex& index);
+	bool isTrunkDataValid(const TrunkIndex& index, const byte* data) const;
+	void releaseTrunkData(TrunkIndex& index);
+	void evictTrunks(const TrunkIndex* keep);
+	
+	void addResidentTrunk(TrunkIndex& index);
+	void removeResidentTrunk(TrunkIndex& index);
+	void touchResidentTrunk(TrunkIndex& index);
+	
+	// point residentTrunks and the deduplication candidates to the indices again after they moved
+	void relinkIndices();
 	
 public:
 	enum Flags {
 		FTF_None = 0,
 		FTF_Compress = 0x1,
+		// set by setTrunkData, checksum holds the CRC-32C of the stored trunk bytes
+		FTF_Checksum = 0x2,
 		
 		FTF__Default = FTF_Compress,
 	};
 	
+	enum LoadFlags {
+		FTL_None = 0,
+		// read header and index only, trunk data is read from the stream on first access,
+		// the stream must be kept open until detach() or clear() is called
+		FTL_Lazy = 0x1,
+	};
+	
+	FileTrunk();
 	~FileTrunk();
 	
 	inline const std::vector<TrunkIndex>& getIndices() const {
 		return this->indices;
 	}
 	
-	bool load(FileStream& stream);
+	// loads files of version 1 and 2; save always writes version 2, which readers of
+	// version 1 only cannot open
+	bool load(FileStream& stream, const uint loadFlags = FTL_None);
 	void save(FileStream& stream);
 	void clear();
 	
+	// append new and modified trunks followed by a new index table to the file this
+	// trunk was last loaded from or saved to, the stream must be opened for update;
+	// data replaced or deleted since then is left in the file as dead space.
+	// Files of version 1 cannot be appended to and need a full save first.
+	// With a journal, appended data is synced and the header update is recorded in
+	// the journal before the header is overwritten in place.
+	bool saveIncremental(FileStream& stream, FileStream* journal = NULL);
+	
+	// redo the in-place write recorded by saveIncremental, false if the record is
+	// incomplete which means the target was never touched
+	static bool applyJournal(FileStream& journal, FileStream& target);
+	
+	// write the trunks added, removed and changed from base to target into delta, changed
+	// and added trunks are copied as stored
+	static void createDelta(const FileTrunk& base, const FileTrunk& target, FileStream& delta);
+	
+	// apply a delta created against the current trunks, the data is read from delta when
+	// saved so a following saveIncremental writes only the changes; takes the ownership
+	// of delta when true is returned. Returns false and changes nothing when the delta is
+	// damaged or the trunks it changes differ from the base it was created from.
+	bool applyDelta(FileStream* delta);
+	inline bool isFileBound() const { return this->fileLength > 0; }
+	inline size_t getFileLength() const { return this->fileLength; }
+	size_t getDeadBytes() const;
+	
+	// bytes written by save()
+	uint64_t getSaveLength() const;
+	
+	// read all lazily loaded trunks into memory and stop using the source stream
+	void detach();
+	
+	// use a stream of the file last loaded from or saved to as the lazy load source,
+	// trunks in memory can then be dropped and read again from the stream
+	void attach(FileStream& stream);
+	
+	// maximum bytes of lazily loaded trunk data kept in memory, 0 means unlimited;
+	// least recently used trunks are dropped and read again from the stream when needed,
+	// so the pointer returned by getTrunkData is only valid until the next call
+	void setResidentLimit(const size_t bytes);
+	inline size_t getResidentLimit() const { return this->residentLimit; }
+	inline size_t getResidentBytes() const { return this->residentBytes; }
+	bool unloadTrunk(const uint uid, const uint format = 0);
+	
+	// store identical payloads set through setTrunkData once, compressing them only once
+	void setDeduplicate(const bool enabled);
+	inline bool getDeduplicate() const { return this->deduplicate; }
+	
+	// record reads by getTrunkData and readTrunkData into trace, NULL stops recording;
+	// the trace is not owned and must stay open while set
+	inline void setAccessTrace(AccessTrace* trace) { this->accessTrace = trace; }
+	inline AccessTrace* getAccessTrace() const { return this->accessTrace; }
+	
+	inline TrunkDataCache& getCache() { return this->cache; }
+	inline const TrunkDataCache& getCache() const { return this->cache; }
+	
+	// chooses uids of new trunks, random by default like earlier versions; takes the
+	// ownership of allocator and tells it the uids already in use
+	void setUidAllocator(UidAllocator* allocator);
+	
 	inline uint getCount() const { return (uint)this->indices.size(); }
 	uint getAvailableUid();
 	uint newTrunk(const uint format = 0);
 	const uint getTrunkFormat(const uint uid);
+	// the data is only valid until the next call, so unlike the other reads this one is not
+	// safe while other threads read
 	const byte* getTrunkData(const uint uid, const uint format = 0, size_t* length = NULL);
 	const size_t getTrunkDataLength(const uint uid, const uint format = 0);
-	void setTrunkData(const uint uid, const uint format, const byte* data, const uint length, uint flags = FTF__Default);
+	
+	// write the trunk data to output, unlike getTrunkData the result stays valid while
+	// other threads read; decompression and copying happen outside the internal lock
+	bool readTrunkData(const uint uid, const uint format, Stream& output);
+	
+	// read a lazily loaded trunk and put its decompressed data into the cache without
+	// copying it anywhere; length receives the bytes a read would return. Safe to call
+	// while other threads read.
+	bool prefetchTrunk(const uint uid, const uint format, size_t* length);
+	void setTrunkData(const uint uid, const uint format, const byte* data, const size_t length, uint flags = FTF__Default);
+	
+	// payload compressed ahead of setTrunkData, prepareTrunkData touches no trunk state
+	// and can run on any thread; the result is the same as setting data directly
+	struct PreparedTrunkData {
+		const byte* data = NULL;
+		size_t length = 0;
+		uint flags = FTF__Default;
+		
+		uint64_t hash = 0;
+		byte* stored = NULL;
+		size_t storedLength = 0;
+		uint checksum = 0;
+		
+		PreparedTrunkData() { }
+		PreparedTrunkData(const PreparedTrunkData&) = delete;
+		PreparedTrunkData& operator=(const PreparedTrunkData&) = delete;
+		
+		~PreparedTrunkData() {
+			delete [] this->stored;
+		}
+	};
+	
+	// compress and checksum the payload
+	static void prepareTrunkData(PreparedTrunkData& prepared);
+	
+	// content hash used by deduplication, found payloads equal to another trunk need no
+	// compression before setTrunkData
+	static void hashTrunkData(PreparedTrunkData& prepared);
+	
+	// data of prepared must stay valid during the call, the stored bytes are taken over
+	void setTrunkData(const uint uid, const uint format, PreparedTrunkData& prepared);
+	
+	// use length bytes at position of source as the stored data of a trunk, already
+	// compressed when flags has FTF_Compress, holding dataLength bytes of payload or 0 if
+	// unknown; takes the ownership of source, which is closed once no trunk refers to it
+	void setTrunkSource(const uint uid, const uint format, FileStream* source, const size_t position,
+											const uint64_t length, const uint checksum, uint flags = FTF__Default,
+											const uint64_t dataLength = 0);
 	
 	bool deleteTrunk(const uint uid, const uint format = 0);
+	
+	// order the index table, and the data written by the next full save, by the position
+	// of each uid in accessOrder; unlisted trunks follow in their current order
+	void sortTrunks(const std::vector<uint>& accessOrder);
+	
+	// order the index table and data by format, keeping the order within a format
+	void sortTrunksByFormat();
+	
+	// check the stored bytes of all trunks against their checksums, reading the bound
+	// file through one stream per thread; trunks without checksum are skipped
+	bool verify(const std::vector<FileStream*>& streams, std::vector<uint>* corruptedUids = NULL) const;
+	
+private:
+	void setTrunkData(TrunkIndex& index, PreparedTrunkData& prepared);
+	
+	// write the index record of a trunk whose data is at offset of the file
+	static void writeIndexRecord(Stream& stream, const TrunkIndex& index, const uint64_t offset);
+	
+	// the table following the index table of TrunkHeaderDataLengths files
+	void writeDataLengths(Stream& stream) const;
+	
+	// stored bytes of a trunk from memory or its source stream
+	static bool readStoredData(const TrunkIndex& index, std::vector<byte>& buffer);
+	static uint getStoredChecksum(const TrunkIndex& index);
+};
+
+// trunk data read from a file does not match the checksum in its index
+class TrunkChecksumException : public Exception {
+public:
+	const uint uid;
+	const uint format;
+	
+	TrunkChecksumException(const uint uid, const uint format) : uid(uid), format(format) { }
 };
 
 }
@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "trunkcache.h"
+
+namespace ucm {
+
+TrunkDataCache::~TrunkDataCache() {
+	this->clear();
+}
+
+const byte* TrunkDataCache::get(const uint uid, const uint format, size_t* length) {
+	return this->acquire(uid, format, length).get();
+}
+
+std::shared_ptr<const byte> TrunkDataCache::acquire(const uint uid, const uint format, size_t* length) {
+	const auto it = this->lookup.find(makeKey(uid, format));
+	
+	if (it == this->lookup.end()) {
+		this->misses++;
+		return std::shared_ptr<const byte>();
+	}
+	
+	this->hits++;
+	
+	// move to front
+	this->entries.splice(this->entries.begin(), this->entries, it->second);
+	
+	if (length != NULL) {
+		*length = it->second->length;
+	}
+	
+	return it->second->data;
+}
+
+bool TrunkDataCache::touch(const uint uid, const uint format, size_t* length) {
+	const auto it = this->lookup.find(makeKey(uid, format));
+	
+	if (it == this->lookup.end()) {
+		return false;
+	}
+	
+	this->entries.splice(this->entries.begin(), this->entries, it->second);
+	
+	if (length != NULL) {
+		*length = it->second->length;
+	}
+	
+	return true;
+}
+
+const byte* TrunkDataCache::peek(const uint uid, const uint format, size_t* length) const {
+	const auto it = this->lookup.find(makeKey(uid, format));
+	
+	if (it == this->lookup.end()) {
+		return NULL;
+	}
+	
+	*length = it->second->length;
+	return it->second->data.get();
+}
+
+const byte* TrunkDataCache::put(const uint uid, const uint format, byte* data, const size_t length) {
+	this->remove(uid, format);
+	
+	Entry entry;
+	entry.key = makeKey(uid, format);
+	entry.data = std::shared_ptr<byte>(data, std::default_delete<byte[]>());
+	entry.length = length;
+	
+	this->entries.push_front(entry);
+	this->lookup[entry.key] = this->entries.begin();
+	this->usedBytes += length;
+	
+	this->evict(1);
+	
+	return data;
+}
+
+void TrunkDataCache::remove(const uint uid, const uint format) {
+	const auto it = this->lookup.find(makeKey(uid, format));
+	
+	if (it != this->lookup.end()) {
+		this->usedBytes -= it->second->length;
+		this->entries.erase(it->second);
+		this->lookup.erase(it);
+	}
+}
+
+void TrunkDataCache::clear() {
+	this->entries.clear();
+	this->lookup.clear();
+	this->usedBytes = 0;
+}
+
+void TrunkDataCache::evict(const size_t keepCount) {
+	while (this->usedBytes > this->capacity && this->entries.size() > keepCount) {
+		Entry& entry = this->entries.back();
+		
+		this->usedBytes -= entry.length;
+		this->lookup.erase(entry.key);
+		this->entries.pop_back();
+		
+		this->evictions++;
+	}
+}
+
+void TrunkDataCache::setCapacity(const size_t bytes) {
+	this->capacity = bytes;
+	this->evict(0);
+}
+
+void TrunkDataCache::resetStats() {
+	this->hits = 0;
+	this->misses = 0;
+	this->evictions = 0;
+}
+
+}
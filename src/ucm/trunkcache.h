@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef trunkcache_h
+#define trunkcache_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "types.h"
+
+namespace ucm {
+
+// Size-bounded LRU cache of decompressed trunk data, keyed by uid and format.
+class TrunkDataCache {
+private:
+	struct Entry {
+		uint64_t key;
+		std::shared_ptr<byte> data;
+		size_t length;
+	};
+	
+	// most recently used entry first
+	std::list<Entry> entries;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> lookup;
+	
+	size_t capacity;
+	size_t usedBytes = 0;
+	
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	
+	static inline uint64_t makeKey(const uint uid, const uint format) {
+		return ((uint64_t)uid << 32) | format;
+	}
+	
+	void evict(const size_t keepCount);
+	
+public:
+	static constexpr size_t DefaultCapacity = 64 * 1024 * 1024;
+	
+	TrunkDataCache(const size_t capacity = DefaultCapacity) : capacity(capacity) { }
+	~TrunkDataCache();
+	
+	const byte* get(const uint uid, const uint format, size_t* length);
+	
+	// same as get, the returned buffer stays valid after the entry is evicted
+	std::shared_ptr<const byte> acquire(const uint uid, const uint format, size_t* length);
+	
+	// mark an entry as recently used without counting a hit, false if not cached
+	bool touch(const uint uid, const uint format, size_t* length);
+	
+	// the cached data without marking it used or counting a hit or miss, NULL if not cached
+	const byte* peek(const uint uid, const uint format, size_t* length) const;
+	
+	// takes the ownership of data, the returned buffer stays in the cache until
+	// another entry is put, even if it is larger than the capacity
+	const byte* put(const uint uid, const uint format, byte* data, const size_t length);
+	
+	void remove(const uint uid, const uint format);
+	void clear();
+	
+	void setCapacity(const size_t bytes);
+	inline size_t getCapacity() const { return this->capacity; }
+	inline size_t getUsedBytes() const { return this->usedBytes; }
+	inline size_t getCount() const { return this->entries.size(); }
+	
+	inline uint64_t getHits() const { return this->hits; }
+	inline uint64_t getMisses() const { return this->misses; }
+	inline uint64_t getEvictions() const { return this->evictions; }
+	void resetStats();
+};
+
+}
+
+#endif /* trunkcache_h */
@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <time.h>
+
+#include "uidallocator.h"
+
+#define UID_LIMIT 0x100000000ULL
+
+namespace ucm {
+
+////////////////// SequentialUidAllocator //////////////////
+
+uint SequentialUidAllocator::allocate() {
+	if (this->next >= UID_LIMIT) {
+		throw UidExhaustedException();
+	}
+	
+	return (uint)this->next;
+}
+
+void SequentialUidAllocator::use(const uint uid) {
+	if (uid >= this->next) {
+		this->next = (uint64_t)uid + 1;
+	}
+}
+
+void SequentialUidAllocator::reset() {
+	this->next = 1;
+}
+
+////////////////// FreeListUidAllocator //////////////////
+
+uint FreeListUidAllocator::allocate() {
+	if (!this->freeUids.empty()) {
+		return *this->freeUids.begin();
+	}
+	
+	return SequentialUidAllocator::allocate();
+}
+
+void FreeListUidAllocator::use(const uint uid) {
+	if (uid < this->next) {
+		this->freeUids.erase(uid);
+	} else {
+		SequentialUidAllocator::use(uid);
+	}
+}
+
+void FreeListUidAllocator::release(const uint uid) {
+	if (uid > 0 && uid < this->next) {
+		this->freeUids.insert(uid);
+	}
+}
+
+void FreeListUidAllocator::reset() {
+	this->freeUids.clear();
+	SequentialUidAllocator::reset();
+}
+
+////////////////// RandomUidAllocator //////////////////
+
+RandomUidAllocator::RandomUidAllocator() : random((uint)time(NULL)) {
+}
+
+RandomUidAllocator::RandomUidAllocator(const uint seed) : random(seed) {
+}
+
+uint RandomUidAllocator::allocate() {
+	if (this->usedUids.size() >= UID_LIMIT - 1) {
+		throw UidExhaustedException();
+	}
+	
+	uint uid;
+	
+	do {
+		uid = (uint)this->random();
+	} while (uid == 0 || this->usedUids.count(uid) > 0);
+	
+	return uid;
+}
+
+void RandomUidAllocator::use(const uint uid) {
+	this->usedUids.insert(uid);
+}
+
+void RandomUidAllocator::release(const uint uid) {
+	this->usedUids.erase(uid);
+}
+
+void RandomUidAllocator::reset() {
+	this->usedUids.clear();
+}
+
+}
+
+#undef UID_LIMIT
@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef uidallocator_h
+#define uidallocator_h
+
+#include <stdint.h>
+#include <random>
+#include <set>
+#include <unordered_set>
+
+#include "types.h"
+#include "exception.h"
+
+namespace ucm {
+
+// Chooses uids of new trunks. The owner reports every uid taken or given up, including
+// uids chosen by the caller, so allocate never needs to look at the trunks; 0 is never
+// returned since it stands for no trunk.
+class UidAllocator {
+public:
+	virtual ~UidAllocator() { }
+	
+	// a uid not in use, it is not taken until use() is called
+	virtual uint allocate() = 0;
+	
+	virtual void use(const uint uid) = 0;
+	virtual void release(const uint uid) = 0;
+	
+	// all uids were released
+	virtual void reset() = 0;
+};
+
+// Counts up from the largest uid ever used, uids of deleted trunks are not reused.
+// Throws UidExhaustedException after uid 0xffffffff was used.
+class SequentialUidAllocator : public UidAllocator {
+protected:
+	// 2^32 once uid 0xffffffff was used
+	uint64_t next = 1;
+	
+public:
+	uint allocate();
+	void use(const uint uid);
+	void release(const uint) { }
+	void reset();
+};
+
+// Sequential, but uids of deleted trunks are handed out again, lowest first
+class FreeListUidAllocator : public SequentialUidAllocator {
+private:
+	std::set<uint> freeUids;
+	
+public:
+	uint allocate();
+	void use(const uint uid);
+	void release(const uint uid);
+	void reset();
+};
+
+// Random uids like archives created by earlier versions. The same seed gives the same
+// sequence of uids on every platform; without seed the current time is used.
+class RandomUidAllocator : public UidAllocator {
+private:
+	std::mt19937 random;
+	std::unordered_set<uint> usedUids;
+	
+public:
+	RandomUidAllocator();
+	RandomUidAllocator(const uint seed);
+	
+	uint allocate();
+	void use(const uint uid);
+	void release(const uint uid);
+	void reset();
+};
+
+// every uid is in use
+class UidExhaustedException : public Exception {
+};
+
+}
+
+#endif /* uidallocator_h */
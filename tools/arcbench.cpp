@@ -0,0 +1,203 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+// Concurrent archive read stress test and benchmark, build with make arcbench in build/<platform>/
+//
+//   arcbench <archive> [options]
+//
+// Writes an archive of generated chunks to <archive>, loads it lazily and opens random chunks
+// from 1, 2, 4 ... reader threads while a writer thread keeps rewriting and adding chunks.
+// Every chunk read is compared with the data it was generated from.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../src/ucm/archive.h"
+#include "../src/ucm/argline.h"
+
+using namespace ucm;
+
+struct BenchOptions {
+	int threads = 8;
+	int reads = 2000;
+	int chunks = 200;
+	int size = 65536;
+	int residentLimit = 0;
+	int cacheCapacity = 0;
+	bool writer = true;
+};
+
+static void printUsage() {
+	printf("usage: arcbench <archive> [options]\n\n"
+		"  --threads <n>       largest number of reader threads, default 8\n"
+		"  --reads <n>         chunks opened by each reader, default 2000\n"
+		"  --chunks <n>        chunks in the archive, default 200\n"
+		"  --size <bytes>      bytes per chunk, default 65536\n"
+		"  --resident <bytes>  resident limit of the loaded archive, default unlimited\n"
+		"  --cache <bytes>     decompressed data cache capacity, default unchanged\n"
+		"  --no-writer         read only, without the writer thread\n");
+}
+
+static bool readOptions(CommandLineReader& args, BenchOptions& options) {
+	while (args.hasNextArg()) {
+		int* value = NULL;
+		
+		if (args.isArg("--threads")) value = &options.threads;
+		else if (args.isArg("--reads")) value = &options.reads;
+		else if (args.isArg("--chunks")) value = &options.chunks;
+		else if (args.isArg("--size")) value = &options.size;
+		else if (args.isArg("--resident")) value = &options.residentLimit;
+		else if (args.isArg("--cache")) value = &options.cacheCapacity;
+		else if (args.isArg("--no-writer")) options.writer = false;
+		else return false;
+		
+		// nextArg(int*) reads the number following the option
+		if (value == NULL) {
+			args.nextArg();
+		} else if (!args.nextArg(value) || *value < 0) {
+			return false;
+		}
+	}
+	
+	return options.threads > 0 && options.chunks > 0;
+}
+
+// the content of chunk i, compressible but not constant
+static void fillPayload(std::vector<byte>& data, const int i, const int size) {
+	data.resize(size);
+	
+	for (int k = 0; k < size; k++) {
+		data[k] = (byte)(((k * 13 + i) % 251) ^ (k >> 11));
+	}
+}
+
+static void createArchive(const string& path, const BenchOptions& options, std::vector<uint>& uids) {
+	Archive archive;
+	std::vector<byte> data;
+	
+	for (int i = 0; i < options.chunks; i++) {
+		ChunkEntry* entry = archive.newChunk(1);
+		fillPayload(data, i, options.size);
+		entry->stream->write(data.data(), data.size());
+		entry->isCompressed = i % 4 != 0;
+		uids.push_back(entry->uid);
+		archive.updateAndCloseChunk(entry);
+	}
+	
+	archive.save(path);
+}
+
+// open random chunks from threads readers, returns the number of reads with wrong data
+static int runReaders(Archive& archive, const std::vector<uint>& uids, const BenchOptions& options,
+											const int threads, double& seconds) {
+	std::atomic<int> errors(0);
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> readers;
+	
+	const auto start = std::chrono::steady_clock::now();
+	
+	for (int t = 0; t < threads; t++) {
+		readers.push_back(std::thread([&, t] {
+			std::vector<byte> expected;
+			uint seed = t * 7919 + 1;
+			
+			for (int k = 0; k < options.reads; k++) {
+				seed = seed * 1103515245 + 12345;
+				const int i = (int)((seed >> 8) % uids.size());
+				
+				ChunkEntry* entry = archive.openChunk(uids[i]);
+				fillPayload(expected, i, options.size);
+				
+				if (entry == NULL || entry->stream->getLength() != expected.size()
+						|| memcmp(entry->stream->getBuffer(), expected.data(), expected.size()) != 0) {
+					errors++;
+				}
+				
+				if (entry != NULL) {
+					archive.closeChunk(entry);
+				}
+			}
+		}));
+	}
+	
+	// rewrites chunks with the data they already have and adds empty ones
+	std::thread writer([&] {
+		for (int k = 0; options.writer && !stop; k++) {
+			const int i = (k * 37) % (int)uids.size();
+			
+			archive.closeChunk(archive.newChunk(2));
+			
+			ChunkEntry* entry = archive.openChunk(uids[i]);
+			entry->isCompressed = i % 4 != 0;
+			archive.updateAndCloseChunk(entry);
+			
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+	
+	for (std::thread& reader : readers) {
+		reader.join();
+	}
+	
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	
+	stop = true;
+	writer.join();
+	
+	return errors;
+}
+
+int main(const int argc, const char* argv[]) {
+	CommandLineReader args(argc, argv);
+	BenchOptions options;
+	string path;
+	
+	if (!args.nextArg(&path) || !readOptions(args, options)) {
+		printUsage();
+		return 1;
+	}
+	
+	std::vector<uint> uids;
+	int errors = 0;
+	
+	try {
+		createArchive(path, options, uids);
+		
+		printf("%d chunks of %d bytes, %d reads per thread%s\n", options.chunks, options.size, options.reads,
+					 options.writer ? ", with writer" : "");
+		printf("%-8s %12s %10s %8s\n", "threads", "opens/s", "MB/s", "errors");
+		
+		for (int threads = 1; ; threads *= 2) {
+			if (threads > options.threads) threads = options.threads;
+			
+			Archive archive;
+			archive.load(path, true);
+			
+			if (options.residentLimit > 0) archive.setResidentLimit(options.residentLimit);
+			if (options.cacheCapacity > 0) archive.setCacheCapacity(options.cacheCapacity);
+			
+			double seconds;
+			const int threadErrors = runReaders(archive, uids, options, threads, seconds);
+			const double opens = (double)threads * options.reads;
+			
+			printf("%-8d %12.0f %10.1f %8d\n", threads, opens / seconds, opens * options.size / 1e6 / seconds, threadErrors);
+			errors += threadErrors;
+			
+			if (threads == options.threads) break;
+		}
+	} catch (const Exception&) {
+		fprintf(stderr, "%s: archive error\n", (const char*)path);
+		return 2;
+	}
+	
+	return errors > 0 ? 2 : 0;
+}
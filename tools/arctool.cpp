@@ -0,0 +1,300 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Common classes for cross-platform C++ application development.
+//
+//  MIT License
+//  Copyright © 2016-2019 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+// Archive maintenance tool, build with make arctool in build/<platform>/
+//
+//   arctool info <archive>
+//   arctool list <archive>
+//   arctool verify <archive>
+//   arctool compact <archive> [-o <output>] [--order <uid file> | --by-format]
+//   arctool trace <trace file> [--prefetch [<bytes>]]
+//   arctool diff <base archive> <target archive> -o <delta>
+//   arctool apply <archive> <delta>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../src/ucm/archive.h"
+#include "../src/ucm/argline.h"
+#include "../src/ucm/accesstrace.h"
+
+using namespace ucm;
+
+static void printUsage() {
+	printf("usage: arctool <command> <archive> [options]\n\n"
+		"  info <archive>      print chunk count, file size and dead space\n"
+		"  list <archive>      print uid, format and stored length of every chunk\n"
+		"  verify <archive>    check every chunk against its checksum\n"
+		"  compact <archive>   rewrite the archive without dead space\n"
+		"    -o <output>       write to another file instead of replacing the archive\n"
+		"    --order <file>    store chunks in the order of the uids listed in file,\n"
+		"                      separated by whitespace or commas, # starts a comment\n"
+		"    --by-format       store chunks grouped by format\n"
+		"  trace <file>        print the chunk order recommended by an access trace,\n"
+		"                      usable as the uid file of compact --order\n"
+		"    --prefetch [n]    print the chunks worth prefetching instead, up to n bytes\n"
+		"  diff <base> <target> -o <delta>\n"
+		"                      write the chunk changes from base to target into delta\n"
+		"  apply <archive> <delta>\n"
+		"                      update the archive in place, writing only changed chunks\n");
+}
+
+// uids in decimal or 0x prefixed hex
+static bool readAccessOrder(const char* path, std::vector<uint>& uids) {
+	FILE* file = fopen(path, "r");
+	if (file == NULL) return false;
+	
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char* comment = strchr(line, '#');
+		if (comment != NULL) *comment = '\0';
+		
+		for (char* token = strtok(line, " \t\r\n,"); token != NULL; token = strtok(NULL, " \t\r\n,")) {
+			char* end;
+			const unsigned long uid = strtoul(token, &end, 0);
+			
+			if (*end != '\0' || uid == 0 || uid > 0xffffffffUL) {
+				fprintf(stderr, "invalid uid in %s: %s\n", path, token);
+				fclose(file);
+				return false;
+			}
+			
+			uids.push_back((uint)uid);
+		}
+	}
+	
+	fclose(file);
+	return true;
+}
+
+static void printInfo(const Archive& archive) {
+	const ArchiveInfo info(archive);
+	
+	printf("chunks:       %u\n", info.getTrunks().getCount());
+	printf("file size:    %llu\n", (unsigned long long)info.fileSize);
+	printf("dead bytes:   %llu (%.1f%%)\n", (unsigned long long)info.deadBytes,
+				 info.fileSize > 0 ? info.deadBytes * 100.0 / info.fileSize : 0.0);
+	printf("compact size: %llu\n", (unsigned long long)info.logicalArchiveSize);
+}
+
+static void printList(const Archive& archive) {
+	const ArchiveInfo info(archive);
+	
+	printf("%-10s %-10s %-12s %s\n", "uid", "format", "offset", "length");
+	
+	for (const auto& index : info.getTrunks().getIndices()) {
+		printf("0x%08x 0x%08x %-12llu %llu\n", index.uid, index.format,
+					 (unsigned long long)index.offset, (unsigned long long)index.length);
+	}
+}
+
+static int compact(Archive& archive, CommandLineReader& args) {
+	string output, orderPath;
+	bool byFormat = false;
+	
+	while (args.hasNextArg()) {
+		if (args.isArg("-o")) {
+			args.nextArg();
+			if (!args.nextArg(&output)) {
+				printUsage();
+				return 1;
+			}
+		} else if (args.isArg("--order")) {
+			args.nextArg();
+			if (!args.nextArg(&orderPath)) {
+				printUsage();
+				return 1;
+			}
+		} else if (args.isArg("--by-format")) {
+			args.nextArg();
+			byFormat = true;
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+	
+	if (byFormat && !orderPath.isEmpty()) {
+		fprintf(stderr, "--order and --by-format cannot be used together\n");
+		return 1;
+	}
+	
+	if (!orderPath.isEmpty()) {
+		std::vector<uint> uids;
+		if (!readAccessOrder(orderPath, uids)) {
+			fprintf(stderr, "cannot read access order: %s\n", (const char*)orderPath);
+			return 1;
+		}
+		archive.sortChunks(uids);
+	} else if (byFormat) {
+		archive.sortChunksByFormat();
+	}
+	
+	const uint64_t before = ArchiveInfo(archive).fileSize;
+	
+	if (output.isEmpty()) {
+		archive.compact();
+	} else {
+		archive.save(output);
+	}
+	
+	const uint64_t after = ArchiveInfo(archive).fileSize;
+	
+	printf("%llu -> %llu bytes\n", (unsigned long long)before, (unsigned long long)after);
+	return 0;
+}
+
+static void printUids(const std::vector<uint>& uids) {
+	for (size_t i = 0; i < uids.size(); i++) {
+		printf("0x%08x%s", uids[i], (i % 8 == 7 || i == uids.size() - 1) ? "\n" : ", ");
+	}
+}
+
+static int analyzeTrace(const string& path, CommandLineReader& args) {
+	bool prefetch = false;
+	unsigned long long budget = 0;
+	
+	if (args.hasNextArg()) {
+		if (!args.isArg("--prefetch")) {
+			printUsage();
+			return 1;
+		}
+		args.nextArg();
+		prefetch = true;
+		
+		string value;
+		if (args.nextArg(&value)) {
+			char* end;
+			budget = strtoull(value, &end, 0);
+			if (*end != '\0') {
+				printUsage();
+				return 1;
+			}
+		}
+	}
+	
+	AccessTraceReader reader;
+	
+	try {
+		reader.load(path);
+	} catch (const AccessTraceFormatException&) {
+		fprintf(stderr, "%s: not an access trace\n", (const char*)path);
+		return 2;
+	} catch (const FileException&) {
+		fprintf(stderr, "%s: file error\n", (const char*)path);
+		return 2;
+	}
+	
+	unsigned long long bytes = 0, decompressTime = 0;
+	for (const AccessTrace::Record& record : reader.getRecords()) {
+		bytes += record.bytes;
+		decompressTime += record.decompressTime;
+	}
+	
+	const std::vector<uint> order = reader.getRecommendedOrder();
+	
+	printf("# %u reads of %u chunks, %llu bytes, %.3f s decompressing\n",
+				 (uint)reader.getRecords().size(), (uint)order.size(), bytes, decompressTime / 1000000.0);
+	
+	if (prefetch) {
+		printf("# prefetch list\n");
+		printUids(reader.getPrefetchList(budget));
+	} else {
+		printf("# recommended order\n");
+		printUids(order);
+	}
+	
+	return 0;
+}
+
+int main(const int argc, const char* argv[]) {
+	CommandLineReader args(argc, argv);
+	string command, path;
+	
+	if (!args.nextArg(&command) || !args.nextArg(&path)) {
+		printUsage();
+		return 1;
+	}
+	
+	if (command == "trace") {
+		return analyzeTrace(path, args);
+	}
+	
+	if (command == "diff") {
+		string target, option, delta;
+		if (!args.nextArg(&target) || !args.nextArg(&option) || option != "-o" || !args.nextArg(&delta)) {
+			printUsage();
+			return 1;
+		}
+		
+		try {
+			Archive::createDelta(path, target, delta);
+		} catch (const ArchiveFormatInvalidException&) {
+			fprintf(stderr, "not an archive: %s or %s\n", (const char*)path, (const char*)target);
+			return 2;
+		} catch (const FileException&) {
+			fprintf(stderr, "file error\n");
+			return 2;
+		}
+		
+		return 0;
+	}
+	
+	Archive archive;
+	
+	try {
+		// chunk data is read or copied straight from the file when needed
+		archive.load(path, true);
+		
+		if (command == "info") {
+			printInfo(archive);
+		} else if (command == "list") {
+			printList(archive);
+		} else if (command == "verify") {
+			std::vector<uint> corrupted;
+			if (!archive.verify(0, &corrupted)) {
+				for (const uint uid : corrupted) {
+					printf("corrupted: 0x%08x\n", uid);
+				}
+				return 2;
+			}
+			printf("ok\n");
+		} else if (command == "compact") {
+			return compact(archive, args);
+		} else if (command == "apply") {
+			string delta;
+			if (!args.nextArg(&delta)) {
+				printUsage();
+				return 1;
+			}
+			
+			try {
+				archive.applyDelta(delta);
+			} catch (const ArchiveDeltaException&) {
+				fprintf(stderr, "%s: delta is damaged or made for another version of the archive\n", (const char*)delta);
+				return 2;
+			}
+			printf("ok\n");
+		} else {
+			printUsage();
+			return 1;
+		}
+	} catch (const ArchiveFormatInvalidException&) {
+		fprintf(stderr, "%s: not an archive\n", (const char*)path);
+		return 2;
+	} catch (const TrunkChecksumException& e) {
+		fprintf(stderr, "%s: chunk 0x%08x is corrupted\n", (const char*)path, e.uid);
+		return 2;
+	} catch (const FileException&) {
+		fprintf(stderr, "%s: file error\n", (const char*)path);
+		return 2;
+	}
+	
+	return 0;
+}